@@ -8,6 +8,17 @@ void Board::SetOptions(const Options* options) {
   options_ = options;
 }
 
+void Board::DrawField(int x, int y,
+                      const Cairo::RefPtr<Cairo::Context>& context) const {
+  context->save();
+    FieldPath(x, y, context);
+    context->clip();
+    for (int layer = 0; layer < kNumberOfLayers; layer++) {
+      DrawFieldLayer(x, y, static_cast<Layer>(layer), context);
+    }
+  context->restore();
+}
+
 const Options& Board::options() const {
   return *options_;
 }
@@ -7,6 +7,7 @@
 #include <tuple>
 #include <utility>
 
+#include "layer.h"
 #include "options.h"
 
 namespace Grid {
@@ -23,13 +24,27 @@ class Board {
 
   virtual std::pair<double, double> CenterOfField(int x, int y) const = 0;
 
+  // Calls @callback(x, y) for every existing field that may intersect the
+  // rectangle, in the pinned snapshot of the controller.  Missing fields are
+  // not visited; the painter leaves them in the null color.
   virtual void IterateFieldsInRectangle(
       double x_min, double y_min, double x_max, double y_max,
       std::function<void(int, int)> callback) const = 0;
 
-  virtual void DrawField(
+  // Appends the outline of the field to the current path of @context.
+  virtual void FieldPath(
       int x, int y, const Cairo::RefPtr<Cairo::Context>& context) const = 0;
 
+  // Draws one layer of the field.  Drawing is clipped to @FieldPath() by the
+  // caller.
+  virtual void DrawFieldLayer(
+      int x, int y, Layer layer,
+      const Cairo::RefPtr<Cairo::Context>& context) const = 0;
+
+  // Draws all the layers of the field.
+  void DrawField(int x, int y,
+                 const Cairo::RefPtr<Cairo::Context>& context) const;
+
   const Options& options() const;
 
  private:
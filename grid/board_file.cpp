@@ -0,0 +1,294 @@
+#include "board_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace Grid {
+
+namespace {
+
+constexpr char kMagic[8] = {'G', 'R', 'I', 'D', 'B', 'R', 'D', '\0'};
+constexpr uint32_t kVersion = 3;
+constexpr uint32_t kEndianness = 0x01020304;
+constexpr uint64_t kChunkAlignment = 4096;
+
+static_assert(std::is_trivially_copyable<FieldStore::Chunk>::value,
+              "Chunks are stored in files byte by byte.");
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianness;
+  uint32_t chunk_bits;
+  uint32_t chunk_bytes;
+  int64_t current_time;
+  int32_t min_x, max_x, min_y, max_y;
+  uint64_t number_of_chunks;
+  uint64_t index_offset;
+  uint64_t labels_offset;
+  uint64_t number_of_labels;
+  // The styles follow the labels.
+  uint64_t number_of_styles;
+};
+
+struct IndexEntry {
+  int32_t chunk_x;
+  int32_t chunk_y;
+  uint64_t offset;
+  uint64_t number_of_fields;
+};
+
+uint64_t Align(uint64_t offset) {
+  return (offset + kChunkAlignment - 1) / kChunkAlignment * kChunkAlignment;
+}
+
+// Owns a memory-mapped file.  Chunks used in place keep it alive.
+class Mapping {
+ public:
+  Mapping(void* data, size_t size) : data_(data), size_(size) {}
+  ~Mapping() { munmap(data_, size_); }
+
+  const char* data() const { return static_cast<const char*>(data_); }
+  char* mutable_data() { return static_cast<char*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  void* data_;
+  size_t size_;
+};
+
+bool WritePadding(std::FILE* file, uint64_t from, uint64_t to) {
+  static const char zeros[kChunkAlignment] = {};
+  return std::fwrite(zeros, 1, to - from, file) == to - from;
+}
+
+// True when the fields of @chunk are consistent with the index entry and
+// refer only to labels stored in the file.
+bool ValidChunk(const FieldStore::Chunk& chunk, uint64_t number_of_fields,
+                uint64_t number_of_labels) {
+  if (static_cast<uint64_t>(FieldStore::CountFields(chunk)) !=
+      number_of_fields) {
+    return false;
+  }
+  for (int y = 0; y < FieldStore::kChunkSize; y++) {
+    uint64_t row = chunk.occupancy[y];
+    while (row != 0) {
+      const int x = __builtin_ctzll(row);
+      row &= row - 1;
+      const uint32_t label = chunk.label[FieldStore::IndexInChunk(x, y)] &
+                             ~FieldStore::kLabelTemplate;
+      if (label != 0 and label >= number_of_labels) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool SaveBoardFile(const std::string& path, const FieldStore& fields,
+                   const BoardFileInfo& info) {
+  std::vector<IndexEntry> index;
+  std::vector<const FieldStore::Chunk*> chunks;
+  fields.ForEachChunk(
+      [&index, &chunks](int chunk_x, int chunk_y,
+                        const FieldStore::Chunk& chunk,
+                        int number_of_fields) -> void {
+        index.push_back(IndexEntry{chunk_x, chunk_y, 0,
+                                   static_cast<uint64_t>(number_of_fields)});
+        chunks.push_back(&chunk);
+      });
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.endianness = kEndianness;
+  header.chunk_bits = FieldStore::kChunkBits;
+  header.chunk_bytes = sizeof(FieldStore::Chunk);
+  header.current_time = info.current_time;
+  header.min_x = info.min_x;
+  header.max_x = info.max_x;
+  header.min_y = info.min_y;
+  header.max_y = info.max_y;
+  header.number_of_chunks = index.size();
+  header.index_offset = sizeof(Header);
+  uint64_t offset = header.index_offset + index.size() * sizeof(IndexEntry);
+  for (IndexEntry& entry : index) {
+    offset = Align(offset);
+    entry.offset = offset;
+    offset += sizeof(FieldStore::Chunk);
+  }
+  header.labels_offset = offset;
+  header.number_of_labels = fields.labels().Size();
+  header.number_of_styles = fields.StyleTableSize();
+
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok and !index.empty()) {
+    ok = std::fwrite(index.data(), sizeof(IndexEntry), index.size(), file) ==
+        index.size();
+  }
+  offset = header.index_offset + index.size() * sizeof(IndexEntry);
+  for (size_t i = 0; ok and i < index.size(); i++) {
+    ok = WritePadding(file, offset, index[i].offset) and
+        std::fwrite(chunks[i], sizeof(FieldStore::Chunk), 1, file) == 1;
+    offset = index[i].offset + sizeof(FieldStore::Chunk);
+  }
+  for (uint32_t id = 1; ok and id < header.number_of_labels; id++) {
+    const std::string& label = fields.labels().Get(id);
+    const uint32_t length = label.size();
+    ok = std::fwrite(&length, sizeof(length), 1, file) == 1 and
+        std::fwrite(label.data(), 1, length, file) == length;
+  }
+  for (int id = 1; ok and id < fields.StyleTableSize(); id++) {
+    const FieldStore::Style* style = fields.FindStyle(id);
+    const uint8_t defined = (style != nullptr);
+    ok = std::fwrite(&defined, sizeof(defined), 1, file) == 1;
+    if (ok and defined) {
+      const int32_t look[2] = {style->background, style->object};
+      const uint32_t length = style->label.size();
+      ok = std::fwrite(look, sizeof(look), 1, file) == 1 and
+          std::fwrite(&length, sizeof(length), 1, file) == 1 and
+          std::fwrite(style->label.data(), 1, length, file) == length;
+    }
+  }
+  return std::fclose(file) == 0 and ok;
+}
+
+bool LoadBoardFile(const std::string& path, FieldStore& fields,
+                   BoardFileInfo& info) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 or
+      static_cast<uint64_t>(file_stat.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  const uint64_t size = file_stat.st_size;
+  // Private mapping: modified pages are copied by the kernel and never
+  // written back to the file.
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>(data, size);
+
+  Header header;
+  std::memcpy(&header, mapping->data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 or
+      header.version != kVersion or
+      header.endianness != kEndianness or
+      header.chunk_bits != FieldStore::kChunkBits or
+      header.chunk_bytes != sizeof(FieldStore::Chunk) or
+      header.index_offset > size or
+      header.number_of_chunks >
+          (size - header.index_offset) / sizeof(IndexEntry) or
+      header.labels_offset > size) {
+    return false;
+  }
+
+  // Chunks are checked on their first use, so that loading doesn't touch
+  // them.
+  const uint64_t number_of_labels = header.number_of_labels;
+  const std::shared_ptr<const FieldStore::ChunkValidator> validator =
+      std::make_shared<FieldStore::ChunkValidator>(
+          [number_of_labels](const FieldStore::Chunk& chunk,
+                             int number_of_fields) -> bool {
+            return ValidChunk(chunk, number_of_fields, number_of_labels);
+          });
+  FieldStore loaded;
+  for (uint64_t i = 0; i < header.number_of_chunks; i++) {
+    IndexEntry entry;
+    std::memcpy(&entry,
+                mapping->data() + header.index_offset + i * sizeof(IndexEntry),
+                sizeof(entry));
+    if (entry.offset % alignof(FieldStore::Chunk) != 0 or
+        entry.offset > size or
+        size - entry.offset < sizeof(FieldStore::Chunk) or
+        entry.number_of_fields > FieldStore::kChunkArea) {
+      return false;
+    }
+    // The chunk lives inside the mapping and shares its ownership.
+    std::shared_ptr<FieldStore::Chunk> chunk(
+        mapping, reinterpret_cast<FieldStore::Chunk*>(
+                     mapping->mutable_data() + entry.offset));
+    if (!loaded.AddChunk(entry.chunk_x, entry.chunk_y, std::move(chunk),
+                         entry.number_of_fields, validator)) {
+      return false;
+    }
+  }
+
+  uint64_t offset = header.labels_offset;
+  for (uint64_t id = 1; id < header.number_of_labels; id++) {
+    uint32_t length;
+    if (size - offset < sizeof(length)) {
+      return false;
+    }
+    std::memcpy(&length, mapping->data() + offset, sizeof(length));
+    offset += sizeof(length);
+    if (size - offset < length) {
+      return false;
+    }
+    // Labels in the file are distinct, so they get their original ids.
+    if (loaded.InternLabel(std::string(mapping->data() + offset, length)) !=
+        id) {
+      return false;
+    }
+    offset += length;
+  }
+
+  if (header.number_of_styles > FieldStore::kMaxStyle + 1) {
+    return false;
+  }
+  for (uint64_t id = 1; id < header.number_of_styles; id++) {
+    uint8_t defined;
+    int32_t look[2];
+    uint32_t length;
+    if (size - offset < sizeof(defined)) {
+      return false;
+    }
+    std::memcpy(&defined, mapping->data() + offset, sizeof(defined));
+    offset += sizeof(defined);
+    if (!defined) {
+      continue;
+    }
+    if (size - offset < sizeof(look) + sizeof(length)) {
+      return false;
+    }
+    std::memcpy(look, mapping->data() + offset, sizeof(look));
+    std::memcpy(&length, mapping->data() + offset + sizeof(look),
+                sizeof(length));
+    offset += sizeof(look) + sizeof(length);
+    if (size - offset < length) {
+      return false;
+    }
+    loaded.DefineStyle(
+        id, FieldStore::Style{look[0], look[1],
+                              std::string(mapping->data() + offset, length)});
+    offset += length;
+  }
+
+  fields = loaded;
+  info.current_time = header.current_time;
+  info.min_x = header.min_x;
+  info.max_x = header.max_x;
+  info.min_y = header.min_y;
+  info.max_y = header.max_y;
+  return true;
+}
+
+}  // namespace Grid
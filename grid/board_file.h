@@ -0,0 +1,52 @@
+#ifndef GRID_BOARD_FILE_H_
+#define GRID_BOARD_FILE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "field_store.h"
+
+namespace Grid {
+
+// Binary board files.
+//
+// A file starts with a header, followed by a chunk index, the chunks, the
+// label table and the style table:
+//
+//   Header        magic, version and layout parameters, BoardFileInfo,
+//                 number and offsets of the other sections.
+//   Chunk index   (chunk_x, chunk_y, offset, number_of_fields) per chunk.
+//   Chunks        raw FieldStore::Chunk structures, each aligned to a page.
+//   Labels        (length, bytes) for every label except the empty one,
+//                 in the order of their ids.
+//   Styles        for every id from 1: a defined flag byte, then for the
+//                 defined ones (background, object, length, label bytes).
+//
+// Chunks are stored exactly as they are laid out in memory, so a loaded file
+// is mapped into memory and its chunks are used in place: a chunk is read
+// from the disk, and checked, only when somebody looks at it.  Loading reads
+// the header, the chunk index and the label and style tables, so it takes
+// time in proportion to the number of chunks and labels, not fields.  Files
+// are not portable between machines with a different endianness or a
+// different layout of FieldStore::Chunk; loading such a file fails.
+
+// Contents of a board file, apart from the fields.
+struct BoardFileInfo {
+  int64_t current_time;
+  int min_x, max_x, min_y, max_y;
+};
+
+// Returns false on I/O errors.
+bool SaveBoardFile(const std::string& path, const FieldStore& fields,
+                   const BoardFileInfo& info);
+
+// Replaces @fields with the contents of the file.  Returns false when the
+// file can't be read or is not a valid board file; @fields is left intact
+// then.  A chunk that turns out to be invalid on its first use is seen as
+// empty.
+bool LoadBoardFile(const std::string& path, FieldStore& fields,
+                   BoardFileInfo& info);
+
+}  // namespace Grid
+
+#endif  // GRID_BOARD_FILE_H_
@@ -0,0 +1,81 @@
+#include "change_journal.h"
+
+#include <cassert>
+
+namespace Grid {
+
+constexpr uint64_t ChangeJournal::kWriting;
+
+ChangeJournal::ChangeJournal(int capacity_log2)
+    : mask_((uint64_t(1) << capacity_log2) - 1),
+      slots_(new Slot[mask_ + 1]), end_(0) {
+  assert(0 < capacity_log2 and capacity_log2 < 32);
+  for (uint64_t i = 0; i <= mask_; i++) {
+    slots_[i].sequence.store(kWriting, std::memory_order_relaxed);
+  }
+}
+
+void ChangeJournal::Append(const FieldChange& change) {
+  const uint64_t sequence = end_.load(std::memory_order_relaxed);
+  Slot& slot = slots_[sequence & mask_];
+  slot.sequence.store(kWriting, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.position.store(
+      (static_cast<uint64_t>(static_cast<uint32_t>(change.x)) << 32) |
+          static_cast<uint32_t>(change.y),
+      std::memory_order_relaxed);
+  slot.kind.store(static_cast<uint64_t>(change.kind),
+                  std::memory_order_relaxed);
+  slot.value.store(change.value, std::memory_order_relaxed);
+  // Only the writer modifies the pointer, so it can read it plainly.
+  if (slot.values != nullptr or change.values != nullptr) {
+    std::atomic_store(&slot.values, change.values);
+  }
+  slot.sequence.store(sequence, std::memory_order_release);
+  end_.store(sequence + 1, std::memory_order_release);
+}
+
+uint64_t ChangeJournal::End() const {
+  return end_.load(std::memory_order_acquire);
+}
+
+bool ChangeJournal::Read(uint64_t& cursor, std::vector<FieldChange>& changes,
+                         size_t max_changes) const {
+  const uint64_t end = End();
+  const uint64_t capacity = mask_ + 1;
+  // The slot of the oldest change may be being overwritten right now.
+  if (end > capacity and cursor <= end - capacity) {
+    cursor = end - capacity + 1;
+    return false;
+  }
+  const size_t old_size = changes.size();
+  for (; cursor < end and changes.size() - old_size < max_changes; cursor++) {
+    const Slot& slot = slots_[cursor & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != cursor) {
+      break;
+    }
+    const uint64_t position = slot.position.load(std::memory_order_relaxed);
+    FieldChange change;
+    change.kind = static_cast<FieldChange::Kind>(
+        slot.kind.load(std::memory_order_relaxed));
+    change.x = static_cast<int32_t>(position >> 32);
+    change.y = static_cast<int32_t>(position);
+    change.value = slot.value.load(std::memory_order_relaxed);
+    change.values = std::atomic_load(&slot.values);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != cursor) {
+      break;
+    }
+    changes.push_back(change);
+  }
+  if (cursor < end and changes.size() - old_size < max_changes) {
+    // The writer overtook the reader.
+    changes.resize(old_size);
+    const uint64_t new_end = End();
+    cursor = new_end > capacity ? new_end - capacity + 1 : 0;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace Grid
@@ -0,0 +1,102 @@
+#ifndef GRID_CHANGE_JOURNAL_H_
+#define GRID_CHANGE_JOURNAL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Grid {
+
+// A single change of the board.
+struct FieldChange {
+  enum class Kind : uint8_t {
+    // @value is the new background color.
+    kColor,
+    // @value is the new object (see @MakeObject()).
+    kObject,
+    // @value is the id of the new label.
+    kText,
+    // The fog advanced; @value is the new current time.  @x and @y are unused.
+    kFog,
+    // The board was cleared.  @x, @y and @value are unused.
+    kClear,
+    // @value holds the bits of the new float value.
+    kValue,
+    // Colors or objects of a rectangle of fields were set at once.  (@x, @y)
+    // is its upper left corner, @value is (width << 32) | height and
+    // @values holds the new colors or objects, row by row.
+    kColorRegion,
+    kObjectRegion,
+    // @value is the id of the new style of the field, 0 for none.
+    kStyle,
+    // The style with id @value was (re)defined.  @x and @y are unused.
+    kStyleDefinition,
+  };
+
+  Kind kind;
+  int x;
+  int y;
+  int64_t value;
+  // Null unless stated otherwise above.  Never modified once appended.
+  std::shared_ptr<const std::vector<uint32_t>> values;
+};
+
+// An append-only journal of board changes, written by Controller and read
+// by Recorder and by any other consumer.  Every change gets a sequence
+// number, starting from 0.  The journal keeps only the most recent changes in
+// a ring buffer, so a reader that falls too far behind loses some of them and
+// is told so.
+//
+// There can be only one writer at a time, but any number of readers, each
+// with its own cursor.  Readers never block the writer.  The @values of a
+// change are kept alive until its slot is reused.
+class ChangeJournal {
+ public:
+  // Keeps the last 2^@capacity_log2 changes.
+  explicit ChangeJournal(int capacity_log2);
+
+  ChangeJournal(const ChangeJournal&) = delete;
+  ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+  // --------------------------- WRITER FUNCTIONS --------------------------- //
+
+  void Append(const FieldChange& change);
+
+
+  // --------------------------- READER FUNCTIONS --------------------------- //
+
+  // The sequence number of the next change to be appended.  A new reader
+  // should start from here.
+  uint64_t End() const;
+
+  // Appends to @changes at most @max_changes changes, starting from
+  // @cursor, and advances @cursor past them.  Returns false when some
+  // changes after @cursor were already overwritten; then @cursor is moved to
+  // the oldest change still available and nothing is read.
+  bool Read(uint64_t& cursor, std::vector<FieldChange>& changes,
+            size_t max_changes) const;
+
+ private:
+  // Seqlock-protected slot.  Fields are atomic only to keep readers, which
+  // may race with the writer, well-defined.
+  struct Slot {
+    // Sequence number of the stored change, or @kWriting.
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> position;
+    std::atomic<uint64_t> kind;
+    std::atomic<int64_t> value;
+    // Accessed with std::atomic_load() and std::atomic_store().
+    std::shared_ptr<const std::vector<uint32_t>> values;
+  };
+
+  static constexpr uint64_t kWriting = ~uint64_t(0);
+
+  const uint64_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> end_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_CHANGE_JOURNAL_H_
@@ -0,0 +1,97 @@
+#include "chunk_pager.h"
+
+#include <cerrno>
+#include <unistd.h>
+
+namespace Grid {
+
+namespace {
+
+constexpr uint64_t kSlotSize = sizeof(FieldStore::Chunk);
+
+}  // namespace
+
+ChunkSlot::ChunkSlot(std::shared_ptr<ChunkPager> pager, uint64_t index)
+    : pager_(std::move(pager)), index_(index) {}
+
+ChunkSlot::~ChunkSlot() {
+  pager_->Release(index_);
+}
+
+bool ChunkSlot::Read(FieldStore::Chunk& chunk) const {
+  char* data = reinterpret_cast<char*>(&chunk);
+  uint64_t done = 0;
+  while (done < kSlotSize) {
+    const ssize_t result = pread(pager_->fd_, data + done, kSlotSize - done,
+                                 index_ * kSlotSize + done);
+    if (result < 0 and errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return false;
+    }
+    done += result;
+  }
+  return true;
+}
+
+std::shared_ptr<ChunkPager> ChunkPager::Create(const std::string& directory) {
+  std::string path = directory + "/grid-chunks-XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  if (fd < 0) {
+    return nullptr;
+  }
+  // The file lives as long as it is open.
+  unlink(path.c_str());
+  return std::shared_ptr<ChunkPager>(new ChunkPager(fd));
+}
+
+ChunkPager::ChunkPager(int fd)
+    : fd_(fd), free_slots_(), number_of_slots_(0) {}
+
+ChunkPager::~ChunkPager() {
+  close(fd_);
+}
+
+std::shared_ptr<const ChunkSlot> ChunkPager::Write(
+    const FieldStore::Chunk& chunk) {
+  uint64_t index;
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_slots_.empty()) {
+      index = number_of_slots_++;
+    } else {
+      index = free_slots_.back();
+      free_slots_.pop_back();
+    }
+  }
+  // From now on the slot is returned by the destructor of ChunkSlot.
+  std::shared_ptr<const ChunkSlot> slot(
+      new ChunkSlot(shared_from_this(), index));
+  const char* data = reinterpret_cast<const char*>(&chunk);
+  uint64_t done = 0;
+  while (done < kSlotSize) {
+    const ssize_t result = pwrite(fd_, data + done, kSlotSize - done,
+                                  index * kSlotSize + done);
+    if (result < 0 and errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      return nullptr;
+    }
+    done += result;
+  }
+  return slot;
+}
+
+uint64_t ChunkPager::SlotsInUse() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return number_of_slots_ - free_slots_.size();
+}
+
+void ChunkPager::Release(uint64_t index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_slots_.push_back(index);
+}
+
+}  // namespace Grid
@@ -0,0 +1,69 @@
+#ifndef GRID_CHUNK_PAGER_H_
+#define GRID_CHUNK_PAGER_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "field_store.h"
+
+namespace Grid {
+
+// A copy of a chunk in the spill file of a ChunkPager.  The slot is reused
+// when the last reference to it goes away, so any number of stores (e.g. a
+// board and its snapshots) can share it.
+class ChunkSlot {
+ public:
+  ~ChunkSlot();
+
+  ChunkSlot(const ChunkSlot&) = delete;
+  ChunkSlot& operator=(const ChunkSlot&) = delete;
+
+  // Returns false on I/O errors.
+  bool Read(FieldStore::Chunk& chunk) const;
+
+ private:
+  friend class ChunkPager;
+
+  ChunkSlot(std::shared_ptr<ChunkPager> pager, uint64_t index);
+
+  std::shared_ptr<ChunkPager> pager_;
+  uint64_t index_;
+};
+
+// Keeps chunks paged out of memory in a temporary file, which is removed as
+// soon as it is created, in slots of sizeof(FieldStore::Chunk) bytes.  The
+// file grows to the largest number of slots used at once.  Thread-safe.
+class ChunkPager : public std::enable_shared_from_this<ChunkPager> {
+ public:
+  // Returns nullptr when the file can't be created in @directory.
+  static std::shared_ptr<ChunkPager> Create(const std::string& directory);
+  ~ChunkPager();
+
+  ChunkPager(const ChunkPager&) = delete;
+  ChunkPager& operator=(const ChunkPager&) = delete;
+
+  // Returns nullptr on I/O errors.
+  std::shared_ptr<const ChunkSlot> Write(const FieldStore::Chunk& chunk);
+
+  uint64_t SlotsInUse() const;
+
+ private:
+  friend class ChunkSlot;
+
+  explicit ChunkPager(int fd);
+
+  void Release(uint64_t index);
+
+  const int fd_;
+
+  mutable std::mutex mutex_;
+  std::vector<uint64_t> free_slots_;
+  uint64_t number_of_slots_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_CHUNK_PAGER_H_
@@ -0,0 +1,60 @@
+#include "colormap.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "controller.h"
+
+namespace Grid {
+
+constexpr int Colormap::kTableSize;
+
+Colormap::Colormap(const std::vector<int>& colors) : table_(kTableSize) {
+  assert(!colors.empty());
+  const int last = static_cast<int>(colors.size()) - 1;
+  for (int i = 0; i < kTableSize; i++) {
+    const double position = static_cast<double>(i) / (kTableSize - 1) * last;
+    const int from = std::min(static_cast<int>(position), last);
+    const int to = std::min(from + 1, last);
+    const double ratio = position - from;
+    auto Mix = [ratio](int a, int b) -> int {
+      return static_cast<int>(a + (b - a) * ratio + 0.5);
+    };
+    table_[i] = MakeColor(
+        Mix((colors[from] >> 16) & 255, (colors[to] >> 16) & 255),
+        Mix((colors[from] >> 8) & 255, (colors[to] >> 8) & 255),
+        Mix(colors[from] & 255, colors[to] & 255));
+  }
+}
+
+Colormap Colormap::Grayscale() {
+  return Colormap({MakeColor(0, 0, 0), MakeColor(255, 255, 255)});
+}
+
+Colormap Colormap::Viridis() {
+  return Colormap({MakeColor(68, 1, 84), MakeColor(59, 82, 139),
+                   MakeColor(33, 145, 140), MakeColor(94, 201, 98),
+                   MakeColor(253, 231, 37)});
+}
+
+Colormap Colormap::Heat() {
+  return Colormap({MakeColor(0, 0, 0), MakeColor(230, 0, 0),
+                   MakeColor(255, 210, 0), MakeColor(255, 255, 255)});
+}
+
+Colormap Colormap::Diverging() {
+  return Colormap({MakeColor(59, 76, 192), MakeColor(245, 245, 245),
+                   MakeColor(180, 4, 38)});
+}
+
+int Colormap::Color(double t) const {
+  if (!(t > 0.0)) {
+    return table_.front();
+  }
+  if (t >= 1.0) {
+    return table_.back();
+  }
+  return table_[static_cast<int>(t * (kTableSize - 1) + 0.5)];
+}
+
+}  // namespace Grid
@@ -0,0 +1,36 @@
+#ifndef GRID_COLORMAP_H_
+#define GRID_COLORMAP_H_
+
+#include <vector>
+
+namespace Grid {
+
+// Maps numbers from [0, 1] to colors (made with MakeColor()).  The colors
+// given to the constructor are spread evenly over [0, 1] and interpolated
+// linearly; the result is precomputed, so looking up a color is cheap.
+class Colormap {
+ public:
+  // At least one color.
+  explicit Colormap(const std::vector<int>& colors);
+
+  // From black to white.
+  static Colormap Grayscale();
+  // From dark blue through green to yellow.
+  static Colormap Viridis();
+  // From black through red and yellow to white.
+  static Colormap Heat();
+  // From blue through white to red.
+  static Colormap Diverging();
+
+  // Values outside of [0, 1] (and NaN) are clamped.
+  int Color(double t) const;
+
+ private:
+  static constexpr int kTableSize = 1024;
+
+  std::vector<int> table_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_COLORMAP_H_
@@ -0,0 +1,251 @@
+#include "command_log.h"
+
+#include <cstring>
+
+namespace Grid {
+
+namespace CommandLog {
+
+// A keyframe consists of:
+//   zigzag current time, zigzag min_x, max_x, min_y, max_y,
+//   number of labels, labels with ids 1, 2, ... (strings),
+//   number of chunks, and for every chunk:
+//     zigzag chunk_x, chunk_y, kChunkSize occupancy rows, kChunkSize
+//     has_value rows,
+//     for every existing field (in the order of indices in the chunk):
+//       background, object, current time - last update time, label id,
+//       bits of the value if the field has one.
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void AppendVarint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void AppendString(std::string& out, const std::string& value) {
+  AppendVarint(out, value.size());
+  out += value;
+}
+
+void AppendStyle(std::string& out, const FieldStore::Style& style) {
+  AppendVarint(out, static_cast<uint32_t>(style.background));
+  AppendVarint(out, static_cast<uint32_t>(style.object));
+  AppendString(out, style.label);
+}
+
+void AppendKeyframe(std::string& out, const FieldStore& fields,
+                    const BoardFileInfo& info) {
+  AppendVarint(out, ZigZag(info.current_time));
+  AppendVarint(out, ZigZag(info.min_x));
+  AppendVarint(out, ZigZag(info.max_x));
+  AppendVarint(out, ZigZag(info.min_y));
+  AppendVarint(out, ZigZag(info.max_y));
+  const uint32_t number_of_labels = fields.labels().Size();
+  AppendVarint(out, number_of_labels - 1);
+  for (uint32_t id = 1; id < number_of_labels; id++) {
+    AppendString(out, fields.labels().Get(id));
+  }
+  // Undefined styles are written as a 0 followed by nothing.
+  AppendVarint(out, fields.StyleTableSize());
+  for (int id = 1; id < fields.StyleTableSize(); id++) {
+    const FieldStore::Style* style = fields.FindStyle(id);
+    AppendVarint(out, style != nullptr);
+    if (style != nullptr) {
+      AppendStyle(out, *style);
+    }
+  }
+  std::string chunks;
+  uint64_t number_of_chunks = 0;
+  fields.ForEachChunk(
+      [&chunks, &number_of_chunks, &info](
+          int chunk_x, int chunk_y, const FieldStore::Chunk& chunk,
+          int) -> void {
+        number_of_chunks++;
+        AppendVarint(chunks, ZigZag(chunk_x));
+        AppendVarint(chunks, ZigZag(chunk_y));
+        for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+          AppendVarint(chunks, chunk.occupancy[dy]);
+        }
+        for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+          AppendVarint(chunks, chunk.has_value[dy] & chunk.occupancy[dy]);
+        }
+        for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+          uint64_t row = chunk.occupancy[dy];
+          while (row != 0) {
+            const int dx = __builtin_ctzll(row);
+            row &= row - 1;
+            const int index = dy * FieldStore::kChunkSize + dx;
+            AppendVarint(chunks, static_cast<uint32_t>(chunk.background[index]));
+            AppendVarint(chunks, static_cast<uint32_t>(chunk.object[index]));
+            AppendVarint(chunks,
+                         static_cast<uint64_t>(info.current_time) -
+                             static_cast<uint64_t>(
+                                 chunk.last_update_time[index]));
+            AppendVarint(chunks, chunk.label[index]);
+            AppendVarint(chunks, chunk.style[index]);
+            if (chunk.has_value[dy] >> dx & 1) {
+              uint32_t bits;
+              std::memcpy(&bits, &chunk.value[index], sizeof(bits));
+              AppendVarint(chunks, bits);
+            }
+          }
+        }
+      });
+  AppendVarint(out, number_of_chunks);
+  out += chunks;
+}
+
+bool Reader::ReadByte(uint8_t& value) {
+  if (position_ == end_) {
+    return false;
+  }
+  value = static_cast<uint8_t>(*position_++);
+  return true;
+}
+
+bool Reader::ReadVarint(uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!ReadByte(byte)) {
+      return false;
+    }
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Reader::ReadString(std::string& value) {
+  uint64_t length;
+  if (!ReadVarint(length) or
+      length > static_cast<uint64_t>(end_ - position_)) {
+    return false;
+  }
+  value.assign(position_, length);
+  position_ += length;
+  return true;
+}
+
+bool Reader::ReadStyle(FieldStore::Style& style) {
+  uint64_t background, object;
+  if (!ReadVarint(background) or !ReadVarint(object) or
+      !ReadString(style.label)) {
+    return false;
+  }
+  style.background = static_cast<uint32_t>(background);
+  style.object = static_cast<uint32_t>(object);
+  return true;
+}
+
+bool Reader::ReadKeyframe(FieldStore& fields, BoardFileInfo& info) {
+  uint64_t current_time, min_x, max_x, min_y, max_y, number_of_labels;
+  if (!ReadVarint(current_time) or !ReadVarint(min_x) or
+      !ReadVarint(max_x) or !ReadVarint(min_y) or !ReadVarint(max_y) or
+      !ReadVarint(number_of_labels)) {
+    return false;
+  }
+  info.current_time = UnZigZag(current_time);
+  info.min_x = UnZigZag(min_x);
+  info.max_x = UnZigZag(max_x);
+  info.min_y = UnZigZag(min_y);
+  info.max_y = UnZigZag(max_y);
+  FieldStore loaded;
+  std::string label;
+  for (uint64_t id = 1; id <= number_of_labels; id++) {
+    if (!ReadString(label) or loaded.InternLabel(label) != id) {
+      return false;
+    }
+  }
+  uint64_t number_of_styles;
+  if (!ReadVarint(number_of_styles) or
+      number_of_styles > FieldStore::kMaxStyle + 1) {
+    return false;
+  }
+  FieldStore::Style style;
+  for (uint64_t id = 1; id < number_of_styles; id++) {
+    uint64_t defined;
+    if (!ReadVarint(defined) or (defined and !ReadStyle(style))) {
+      return false;
+    }
+    if (defined) {
+      loaded.DefineStyle(id, style);
+    }
+  }
+  uint64_t number_of_chunks;
+  if (!ReadVarint(number_of_chunks)) {
+    return false;
+  }
+  for (uint64_t i = 0; i < number_of_chunks; i++) {
+    uint64_t chunk_x, chunk_y;
+    uint64_t occupancy[FieldStore::kChunkSize];
+    uint64_t has_value[FieldStore::kChunkSize];
+    if (!ReadVarint(chunk_x) or !ReadVarint(chunk_y)) {
+      return false;
+    }
+    for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+      if (!ReadVarint(occupancy[dy])) {
+        return false;
+      }
+    }
+    for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+      if (!ReadVarint(has_value[dy])) {
+        return false;
+      }
+    }
+    const int base_x = UnZigZag(chunk_x) * FieldStore::kChunkSize;
+    const int base_y = UnZigZag(chunk_y) * FieldStore::kChunkSize;
+    for (int dy = 0; dy < FieldStore::kChunkSize; dy++) {
+      uint64_t row = occupancy[dy];
+      while (row != 0) {
+        const int dx = __builtin_ctzll(row);
+        row &= row - 1;
+        uint64_t background, object, age, label_id, style_id;
+        if (!ReadVarint(background) or !ReadVarint(object) or
+            !ReadVarint(age) or !ReadVarint(label_id) or
+            (label_id & ~uint64_t(FieldStore::kLabelTemplate)) >
+                number_of_labels or !ReadVarint(style_id) or
+            style_id > FieldStore::kMaxStyle) {
+          return false;
+        }
+        const int64_t time = static_cast<int64_t>(
+            static_cast<uint64_t>(info.current_time) - age);
+        bool created;
+        FieldStore::FieldRef field = loaded.FindOrCreate(
+            base_x + dx, base_y + dy, static_cast<uint32_t>(background),
+            static_cast<uint32_t>(object), time, created);
+        field.label() = label_id;
+        field.style() = style_id;
+        if (has_value[dy] >> dx & 1) {
+          uint64_t bits;
+          if (!ReadVarint(bits)) {
+            return false;
+          }
+          const uint32_t bits32 = static_cast<uint32_t>(bits);
+          float value;
+          std::memcpy(&value, &bits32, sizeof(value));
+          field.set_value(value);
+        }
+      }
+    }
+  }
+  fields = loaded;
+  return true;
+}
+
+}  // namespace CommandLog
+
+}  // namespace Grid
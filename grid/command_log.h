@@ -0,0 +1,95 @@
+#ifndef GRID_COMMAND_LOG_H_
+#define GRID_COMMAND_LOG_H_
+
+#include <cstdint>
+#include <string>
+
+#include "board_file.h"
+#include "field_store.h"
+
+namespace Grid {
+
+// Format of the logs written by Recorder and played by Replay.
+//
+// A log starts with @kMagic and @kVersion, followed by records.  Every record
+// is an opcode byte and the microseconds elapsed since the previous record
+// (a varint), followed by the arguments of the opcode.  Coordinates are
+// zigzag varints relative to the coordinates of the previous record that had
+// any.  Strings are a varint length followed by the bytes.
+//
+// A keyframe holds the whole board and resets the relative coordinates to
+// (0, 0), so the playback can start from any keyframe.  A log always starts
+// with one.
+namespace CommandLog {
+
+constexpr char kMagic[8] = {'G', 'R', 'I', 'D', 'L', 'O', 'G', '\0'};
+constexpr uint32_t kVersion = 4;
+
+enum class Opcode : uint8_t {
+  // Varint size of the board in bytes, then the board (see
+  // @AppendKeyframe()).
+  kKeyframe = 0,
+  // Coordinates, varint color.
+  kSetFieldColor = 1,
+  // Coordinates, varint object.
+  kSetObject = 2,
+  // Coordinates, string.
+  kSetText = 3,
+  kSetFog = 4,
+  // Coordinates.
+  kCenterOn = 5,
+  // String.
+  kAddMessage = 6,
+  kClear = 7,
+  // Coordinates, varint bits of the float value.
+  kSetFieldValue = 8,
+  // Coordinates, varint width, height, then width * height varint values,
+  // row by row.
+  kSetRegionColors = 9,
+  kSetRegionObjects = 10,
+  // Coordinates, varint id of the style.
+  kSetStyle = 11,
+  // Varint id, then the style (see @AppendStyle()).
+  kDefineStyle = 12,
+};
+
+uint64_t ZigZag(int64_t value);
+int64_t UnZigZag(uint64_t value);
+
+void AppendVarint(std::string& out, uint64_t value);
+void AppendString(std::string& out, const std::string& value);
+
+// Varint background and object, string label.
+void AppendStyle(std::string& out, const FieldStore::Style& style);
+
+// Appends the board, without the opcode and the time.
+void AppendKeyframe(std::string& out, const FieldStore& fields,
+                    const BoardFileInfo& info);
+
+// Reads consecutive values from a buffer.  Every function returns false when
+// the buffer ends too early.
+class Reader {
+ public:
+  Reader(const char* begin, const char* end) : position_(begin), end_(end) {}
+
+  bool AtEnd() const { return position_ == end_; }
+  const char* position() const { return position_; }
+
+  bool ReadByte(uint8_t& value);
+  bool ReadVarint(uint64_t& value);
+  bool ReadString(std::string& value);
+  bool ReadStyle(FieldStore::Style& style);
+
+  // Reads the board written by @AppendKeyframe().
+  bool ReadKeyframe(FieldStore& fields, BoardFileInfo& info);
+
+ private:
+  const char* position_;
+  const char* end_;
+};
+
+}  // namespace CommandLog
+
+}  // namespace Grid
+
+#endif  // GRID_COMMAND_LOG_H_
@@ -1,9 +1,17 @@
 #include "controller.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <limits>
 
+#include "board.h"
+#include "chunk_pager.h"
+#include "colormap.h"
 #include "options.h"
 #include "painter.h"
+#include "recorder.h"
 #include "viewer.h"
 
 namespace Grid {
@@ -23,6 +31,36 @@ double GetDoubleB(int color) {
   return (color & 255) / 255.0;
 }
 
+namespace {
+
+// Tiles of labels made by the label provider, 64 x 64 fields each, in all
+// the shards together.
+constexpr size_t kMaxLabelTiles = 256;
+
+// Changes whenever anything but the time of the field changes.
+uint64_t FieldStamp(const FieldStore::FieldView& field) {
+  uint32_t value_bits = 0;
+  if (field.has_value()) {
+    const float value = field.value();
+    std::memcpy(&value_bits, &value, sizeof(value_bits));
+  }
+  uint64_t stamp = 0;
+  for (uint64_t part : {static_cast<uint64_t>(static_cast<uint32_t>(
+                            field.background())),
+                        static_cast<uint64_t>(static_cast<uint32_t>(
+                            field.object())),
+                        static_cast<uint64_t>(field.label()),
+                        static_cast<uint64_t>(field.style()),
+                        static_cast<uint64_t>(field.has_value()),
+                        static_cast<uint64_t>(value_bits)}) {
+    stamp = (stamp ^ part) * 0x9e3779b97f4a7c15;
+    stamp ^= stamp >> 29;
+  }
+  return stamp;
+}
+
+}  // namespace
+
 Controller::Controller()
     : options_(nullptr), viewer_(nullptr), painter_(nullptr),
       main_message_box_(0.0 /* R */, 0.0 /* G */, 0.0 /* B */, 1.0 /* A */,
@@ -33,35 +71,73 @@ Controller::Controller()
       on_key_press_callback_([](const std::string&) -> void {}),
       current_time_(std::numeric_limits<int64_t>::min()),
       min_x_(0), max_x_(0), min_y_(0), max_y_(0),
-      fields_() {}
+      fields_(), index_fields_(false), object_index_(), color_index_(),
+      style_index_(), label_provider_(),
+      colormap_(std::make_shared<Colormap>(Colormap::Viridis())),
+      value_min_(0.0), value_max_(1.0),
+      journal_(16 /* capacity_log2 */),
+      snapshot_outdated_(false),
+      drawing_scale_(0.0), history_(), newest_turn_(), history_position_(-1),
+      shown_turn_(),
+      pager_(), spilling_failed_(false),
+      viewport_min_x_(0),
+      viewport_min_y_(0), viewport_max_x_(0), viewport_max_y_(0),
+      visible_region_{0, 0, -1, -1, 0.0},
+      on_viewport_changed_callback_([](const VisibleRegion&) -> void {}) {
+  PublishSnapshot();
+  pinned_snapshot_ = snapshot_;
+}
+
+Controller::~Controller() = default;
+
+constexpr int Controller::kLabelCacheShards;
+
+Controller::LabelCacheShard::LabelCacheShard()
+    : mutex(), cache(kMaxLabelTiles / kLabelCacheShards) {}
 
 void Controller::Clear() {
-  std::lock_guard<std::mutex> lock(mutex_);
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    min_x_ = max_x_ = min_y_ = max_y_ = 0;
+    fields_.Clear();
+    RebuildIndexes();
+    DropHistory();
+    shapes_.clear();
+    current_time_ = std::numeric_limits<int64_t>::min();
+    AppendChange({FieldChange::Kind::kClear, 0, 0, 0});
+    PublishSnapshot();
+  }
+  // The painter redraws from the empty board, which is published by now.
   InvalidateEverything();
-  min_x_ = max_x_ = min_y_ = max_y_ = 0;
-  fields_.clear();
-  current_time_ = std::numeric_limits<int64_t>::min();
 }
 
 void Controller::SetFieldColor(int x, int y, int r, int g, int b) {
   /* Lock */ {
     std::lock_guard<std::mutex> lock(mutex_);
-    Field* field = GetField(x, y, true /* force */);
-    field->background = MakeColor(r, g, b);
-    field->last_update_time = current_time_;
+    const LayerMask layers = SetFieldColorLocked(x, y, MakeColor(r, g, b));
+    snapshot_outdated_.store(true);
+    InvalidateField(x, y, layers);
+  }
+}
+
+void Controller::SetFieldValue(int x, int y, float value) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const LayerMask layers = SetFieldValueLocked(x, y, value);
+    snapshot_outdated_.store(true);
+    InvalidateField(x, y, layers);
   }
-  InvalidateField(x, y);
 }
 
 void Controller::SetObject(int x, int y,
                            Object object, int r, int g, int b) {
   /* Lock */ {
     std::lock_guard<std::mutex> lock(mutex_);
-    Field* field = GetField(x, y, true /* force */);
-    field->object = MakeObject(object, r, g, b);
-    field->last_update_time = current_time_;
+    const LayerMask layers =
+        SetObjectLocked(x, y, MakeObject(object, r, g, b));
+    snapshot_outdated_.store(true);
+    InvalidateField(x, y, layers);
   }
-  InvalidateField(x, y);
 }
 
 StreamReader Controller::SetText(int x, int y) {
@@ -69,23 +145,147 @@ StreamReader Controller::SetText(int x, int y) {
       [this, x, y](const std::string& message) -> void {
         /* Lock */ {
           std::lock_guard<std::mutex> lock(mutex_);
-          Field* field = GetField(x, y, true /* force */);
-          field->text = message;
-          field->last_update_time = current_time_;
+          const LayerMask layers = SetTextLocked(x, y, message);
+          snapshot_outdated_.store(true);
+          InvalidateField(x, y, layers);
         }
-        InvalidateField(x, y);
       });
 }
 
+void Controller::DefineStyle(int id, int r, int g, int b, Object object,
+                             int object_r, int object_g, int object_b,
+                             const std::string& label) {
+  DefineStyle(id, FieldStore::Style{
+      MakeColor(r, g, b), MakeObject(object, object_r, object_g, object_b),
+      label});
+}
+
+void Controller::DefineStyle(int id, const FieldStore::Style& style) {
+  assert(0 < id and id <= FieldStore::kMaxStyle);
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fields_.DefineStyle(id, style);
+    AppendChange({FieldChange::Kind::kStyleDefinition, 0, 0, id});
+    PublishSnapshot();
+  }
+  // Fields of the style are not tracked, so every visible field is redrawn.
+  InvalidateEverything(LayerBit(Layer::kTerrain) | LayerBit(Layer::kObjects) |
+                       LayerBit(Layer::kLabels));
+}
+
+void Controller::SetStyle(int x, int y, int id) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const LayerMask layers = SetStyleLocked(x, y, id);
+    snapshot_outdated_.store(true);
+    InvalidateField(x, y, layers);
+  }
+}
+
 void Controller::SetFog() {
+  // Only the fields updated since the previous call become covered by fog.
+  std::vector<std::pair<int, int>> fogged_fields;
   /* Lock */ {
     std::lock_guard<std::mutex> lock(mutex_);
+    PageOutColdChunks();
+    RememberTurn();
+    fields_.ForEachFieldUpdatedAt(
+        current_time_,
+        [&fogged_fields](int x, int y) -> void {
+          fogged_fields.emplace_back(x, y);
+        });
     current_time_++;
+    AppendChange({FieldChange::Kind::kFog, 0, 0, current_time_});
+    PublishSnapshot();
+    InvalidateFields(fogged_fields, LayerBit(Layer::kOverlay));
   }
-  InvalidateEverything();
+}
+
+void Controller::SetRegionColors(int x0, int y0, int width, int height,
+                                 const uint32_t* values, int stride) {
+  SetRegion(x0, y0, width, height, values, stride, Layer::kTerrain);
+}
+
+void Controller::SetRegionObjects(int x0, int y0, int width, int height,
+                                  const uint32_t* values, int stride) {
+  SetRegion(x0, y0, width, height, values, stride, Layer::kObjects);
+}
+
+void Controller::SetLabelProvider(LabelCache::Provider provider) {
+  std::shared_ptr<const LabelCache::Provider> copy;
+  if (provider) {
+    copy = std::make_shared<LabelCache::Provider>(std::move(provider));
+  }
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    label_provider_ = std::move(copy);
+    PublishSnapshot();
+  }
+  InvalidateEverything(LayerBit(Layer::kLabels));
+}
+
+void Controller::SetPolyline(int id,
+                             const std::vector<std::pair<int, int>>& points,
+                             int r, int g, int b, double width) {
+  SetShape(id, Shape{points, MakeColor(r, g, b), width, false});
+}
+
+void Controller::SetArrow(int id, std::pair<int, int> from,
+                          std::pair<int, int> to, int r, int g, int b,
+                          double width) {
+  SetShape(id, Shape{{from, to}, MakeColor(r, g, b), width, true});
+}
+
+void Controller::RemoveShape(int id) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shapes_.erase(id) == 0) {
+      return;
+    }
+  }
+  if (IsInitialized()) {
+    viewer().Redraw();
+  }
+}
+
+void Controller::SetShape(int id, Shape shape) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shapes_[id] = std::move(shape);
+  }
+  if (IsInitialized()) {
+    viewer().Redraw();
+  }
+}
+
+void Controller::SetColormap(const Colormap& colormap) {
+  std::shared_ptr<const Colormap> copy = std::make_shared<Colormap>(colormap);
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    colormap_ = std::move(copy);
+    PublishSnapshot();
+  }
+  InvalidateEverything(LayerBit(Layer::kTerrain));
+}
+
+void Controller::SetValueRange(float min, float max) {
+  assert(min < max);
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    value_min_ = min;
+    value_max_ = max;
+    PublishSnapshot();
+  }
+  InvalidateEverything(LayerBit(Layer::kTerrain));
 }
 
 void Controller::CenterOn(int x, int y) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (recorder_ != nullptr) {
+      recorder_->CenterOn(x, y);
+    }
+  }
   if (!IsInitialized()) {
     return;
   }
@@ -93,10 +293,123 @@ void Controller::CenterOn(int x, int y) {
   viewer().Redraw();
 }
 
+bool Controller::SaveSnapshot(const std::string& path) {
+  std::shared_ptr<const Snapshot> snapshot;
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PublishSnapshot();
+    snapshot = std::atomic_load(&snapshot_);
+  }
+  // The snapshot is immutable, so the file is written without the lock.
+  return SaveBoardFile(
+      path, snapshot->fields,
+      BoardFileInfo{snapshot->current_time, snapshot->min_x, snapshot->max_x,
+                    snapshot->min_y, snapshot->max_y});
+}
+
+bool Controller::LoadSnapshot(const std::string& path) {
+  FieldStore fields;
+  BoardFileInfo info;
+  if (!LoadBoardFile(path, fields, info)) {
+    return false;
+  }
+  ReplaceBoard(fields, info);
+  return true;
+}
+
+bool Controller::StartRecording(const std::string& path) {
+  std::unique_ptr<Recorder> recorder = Recorder::Create(path);
+  if (recorder == nullptr) {
+    return false;
+  }
+  std::unique_ptr<Recorder> previous;
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recorder->Keyframe(
+        fields_,
+        BoardFileInfo{current_time_, min_x_, max_x_, min_y_, max_y_});
+    recorder->SetJournalCursor(journal_.End());
+    previous = std::move(recorder_);
+    recorder_ = std::move(recorder);
+  }
+  // The previous recording is closed without the lock.
+  return true;
+}
+
+bool Controller::StopRecording() {
+  std::unique_ptr<Recorder> recorder;
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recorder = std::move(recorder_);
+  }
+  return recorder == nullptr or recorder->Close();
+}
+
+Controller::Batch::Batch(Controller* controller)
+    : controller_(controller), lock_(controller->mutex_) {
+  // Changes made before the batch must not wait for the end of the batch.
+  if (controller_->snapshot_outdated_.load()) {
+    controller_->PublishSnapshot();
+  }
+}
+
+Controller::Batch::~Batch() {
+  bool published = false;
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    if (changed_fields_[layer].empty()) {
+      continue;
+    }
+    if (!published) {
+      controller_->PageOutColdChunks();
+      controller_->PublishSnapshot();
+      published = true;
+    }
+    controller_->InvalidateFields(changed_fields_[layer],
+                                  LayerBit(static_cast<Layer>(layer)));
+  }
+}
+
+void Controller::Batch::SetFieldColor(int x, int y, int r, int g, int b) {
+  AddChangedField(
+      x, y, controller_->SetFieldColorLocked(x, y, MakeColor(r, g, b)));
+}
+
+void Controller::Batch::SetFieldValue(int x, int y, float value) {
+  AddChangedField(x, y, controller_->SetFieldValueLocked(x, y, value));
+}
+
+void Controller::Batch::SetStyle(int x, int y, int id) {
+  AddChangedField(x, y, controller_->SetStyleLocked(x, y, id));
+}
+
+void Controller::Batch::SetObject(int x, int y,
+                                  Object object, int r, int g, int b) {
+  AddChangedField(
+      x, y, controller_->SetObjectLocked(x, y, MakeObject(object, r, g, b)));
+}
+
+StreamReader Controller::Batch::SetText(int x, int y) {
+  return StreamReader(
+      [this, x, y](const std::string& message) -> void {
+        AddChangedField(x, y, controller_->SetTextLocked(x, y, message));
+      });
+}
+
+void Controller::Batch::AddChangedField(int x, int y, LayerMask layers) {
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    if (layers & LayerBit(static_cast<Layer>(layer))) {
+      changed_fields_[layer].emplace_back(x, y);
+    }
+  }
+}
+
 StreamReader Controller::AddMessage() {
   return StreamReader(
       [this](const std::string& message) -> void {
         std::lock_guard<std::mutex> lock(mutex_);
+        if (recorder_ != nullptr) {
+          recorder_->AddMessage(message);
+        }
         main_message_box_.AddMessage(message);
         if (IsInitialized()) {
           viewer().Redraw();
@@ -114,6 +427,15 @@ void Controller::AddSingleMessageBox(
   }
 }
 
+const ChangeJournal& Controller::journal() const {
+  return journal_;
+}
+
+std::string Controller::GetLabel(uint32_t id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return fields_.Label(id);
+}
+
 void Controller::OnFieldClick(std::function<void(int, int, int)> callback) {
   std::lock_guard<std::mutex> lock(mutex_);
   on_field_click_callback_ = callback;
@@ -124,32 +446,279 @@ void Controller::OnKeyPress(std::function<void(const std::string&)> callback) {
   on_key_press_callback_ = callback;
 }
 
+void Controller::ForEachInRect(
+    int x0, int y0, int x1, int y1,
+    const std::function<void(const FieldState&)>& visitor) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FieldState state;
+  std::string style_label;
+  fields_.ForEachInRect(
+      x0, y0, x1, y1,
+      [this, &state, &style_label, &visitor](
+          int x, int y, FieldStore::FieldView field) -> void {
+        state.x = x;
+        state.y = y;
+        state.has_value = field.has_value();
+        state.value = state.has_value ? field.value() : 0.0f;
+        state.style = field.style();
+        state.fog = (field.last_update_time() < current_time_);
+        const FieldStore::Style* style = fields_.FindStyle(field.style());
+        if (style != nullptr) {
+          state.color = style->background;
+          state.object = style->object;
+          style_label = FieldStore::ExpandLabel(style->label, x, y);
+          state.text = &style_label;
+        } else {
+          state.color = field.background();
+          state.object = field.object();
+          state.text = &fields_.FieldLabel(field.label(), x, y, style_label);
+        }
+        visitor(state);
+      });
+}
+
+std::vector<std::pair<int, int>> Controller::FindObjects(Object object) {
+  const int type = static_cast<int>(object);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<int, int>> found;
+  if (object == Object::kNone) {
+    return found;
+  }
+  if (index_fields_) {
+    found = object_index_.Find(type);
+    FindStyled([type](int, int object, bool) -> bool {
+                 return ((object >> 24) & 255) == type;
+               },
+               found);
+    return found;
+  }
+  fields_.ForEachInRect(
+      min_x_, min_y_, max_x_, max_y_,
+      [this, type, &found](int x, int y, FieldStore::FieldView field) -> void {
+        const FieldStore::Style* style = fields_.FindStyle(field.style());
+        const int field_object =
+            style != nullptr ? style->object : field.object();
+        if (((field_object >> 24) & 255) == type) {
+          found.emplace_back(x, y);
+        }
+      });
+  return found;
+}
+
+std::vector<std::pair<int, int>> Controller::FindColor(int r, int g, int b) {
+  const int color = MakeColor(r, g, b);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<int, int>> found;
+  if (index_fields_) {
+    found = color_index_.Find(color);
+    FindStyled([color](int background, int, bool has_value) -> bool {
+                 return !has_value and background == color;
+               },
+               found);
+    return found;
+  }
+  fields_.ForEachInRect(
+      min_x_, min_y_, max_x_, max_y_,
+      [this, color, &found](int x, int y, FieldStore::FieldView field) -> void {
+        const FieldStore::Style* style = fields_.FindStyle(field.style());
+        if (style != nullptr ? style->background == color
+                             : !field.has_value() and
+                                   field.background() == color) {
+          found.emplace_back(x, y);
+        }
+      });
+  return found;
+}
+
+std::vector<std::pair<int, int>> Controller::FindStyle(int id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_fields_) {
+    return style_index_.Find(id);
+  }
+  std::vector<std::pair<int, int>> found;
+  if (id <= 0) {
+    return found;
+  }
+  fields_.ForEachInRect(
+      min_x_, min_y_, max_x_, max_y_,
+      [id, &found](int x, int y, FieldStore::FieldView field) -> void {
+        if (field.style() == id) {
+          found.emplace_back(x, y);
+        }
+      });
+  return found;
+}
+
+Controller::State::State() : fields_(std::make_shared<FieldStore>()) {}
+
+Controller::State Controller::SaveState() {
+  State state;
+  std::lock_guard<std::mutex> lock(mutex_);
+  state.fields_ = std::make_shared<FieldStore>(fields_);
+  return state;
+}
+
+bool Controller::LoadState(const std::string& path, State& state) {
+  std::shared_ptr<FieldStore> fields = std::make_shared<FieldStore>();
+  BoardFileInfo info;
+  if (!LoadBoardFile(path, *fields, info)) {
+    return false;
+  }
+  state.fields_ = std::move(fields);
+  return true;
+}
+
+std::vector<std::pair<int, int>> Controller::Diff(const State& a,
+                                                  const State& b) {
+  std::vector<std::pair<int, int>> differences;
+  a.fields_->ForEachDifference(
+      *b.fields_,
+      [&differences](int x, int y) -> void {
+        differences.emplace_back(x, y);
+      });
+  return differences;
+}
+
+int64_t Controller::SpillReadErrors() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return fields_.ReadErrors();
+}
+
+Controller::VisibleRegion Controller::GetVisibleRegion() {
+  std::lock_guard<std::mutex> lock(visible_region_mutex_);
+  return visible_region_;
+}
+
+void Controller::OnViewportChanged(
+    std::function<void(const VisibleRegion&)> callback) {
+  std::lock_guard<std::mutex> lock(visible_region_mutex_);
+  on_viewport_changed_callback_ = callback;
+}
+
+int64_t Controller::CountWhere(
+    int x0, int y0, int x1, int y1,
+    const std::function<bool(const FieldState&)>& predicate) {
+  int64_t count = 0;
+  ForEachInRect(x0, y0, x1, y1,
+                [&count, &predicate](const FieldState& state) -> void {
+                  if (predicate(state)) {
+                    count++;
+                  }
+                });
+  return count;
+}
+
+void Controller::PinSnapshot() {
+  if (snapshot_outdated_.load()) {
+    // Changes made outside of batches are published lazily.  The lock is
+    // taken at most once per pin, never per field.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (snapshot_outdated_.load()) {
+      PublishSnapshot();
+    }
+  }
+  std::shared_ptr<const Snapshot> shown_turn = std::atomic_load(&shown_turn_);
+  pinned_snapshot_ = shown_turn != nullptr ? std::move(shown_turn)
+                                           : std::atomic_load(&snapshot_);
+}
+
 void Controller::GetExtensions(int& min_x, int& min_y, int& max_x, int& max_y) {
+  min_x = pinned_snapshot_->min_x;
+  min_y = pinned_snapshot_->min_y;
+  max_x = pinned_snapshot_->max_x;
+  max_y = pinned_snapshot_->max_y;
+}
+
+void Controller::SetDrawingScale(double scale) {
+  drawing_scale_ = scale;
+}
+
+void Controller::StepHistory(int turns) {
   std::lock_guard<std::mutex> lock(mutex_);
-  min_x = min_x_;
-  min_y = min_y_;
-  max_x = max_x_;
-  max_y = max_y_;
+  const int64_t size = history_.size();
+  const int64_t from = history_position_ < 0 ? size : history_position_;
+  const int64_t to = std::max<int64_t>(0, std::min(size, from + turns));
+  if (to == from) {
+    return;
+  }
+  if (snapshot_outdated_.load()) {
+    PublishSnapshot();
+  }
+  const std::shared_ptr<const Snapshot> current = std::atomic_load(&snapshot_);
+  const std::shared_ptr<const Snapshot> shown_before =
+      from < size ? std::atomic_load(&shown_turn_) : current;
+  const std::shared_ptr<const Snapshot> shown =
+      to < size ? TurnSnapshot(to) : nullptr;
+  history_position_ = to < size ? static_cast<int>(to) : -1;
+  std::atomic_store(&shown_turn_, shown);
+  InvalidateDifferences(*shown_before, shown != nullptr ? *shown : *current);
+}
+
+void Controller::ForEachPinnedField(
+    int x0, int y0, int x1, int y1,
+    const std::function<void(int, int)>& callback) {
+  pinned_snapshot_->fields.ForEachInRect(
+      x0, y0, x1, y1,
+      [&callback](int x, int y, FieldStore::FieldView) -> void {
+        callback(x, y);
+      });
 }
 
 void Controller::GetFieldInfo(int x, int y, bool& border, int& background,
-                              int& object, std::string& text, bool& fog) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  Field* field = GetField(x, y, false /* don't force */);
-  if (field == nullptr) {
+                              int& object, const std::string*& text,
+                              bool& fog) {
+  // Labels made for the field, returned to the drawing thread.
+  static thread_local std::string style_label;
+  static thread_local std::string provider_label;
+  const FieldStore::FieldView field = pinned_snapshot_->fields.Find(x, y);
+  if (!field) {
     const int null_color = options().NullColor();
     border = false;
     background = MakeColor(null_color, null_color, null_color);
     object = MakeObject(Object::kNone, 0, 0, 0);
-    text.clear();
+    text = &pinned_snapshot_->fields.Label(0);
     fog = false;
     return;
   }
   border = true;
-  background = field->background;
-  object = field->object;
-  text = field->text;
-  fog = (field->last_update_time < current_time_);
+  fog = (field.last_update_time() < pinned_snapshot_->current_time);
+  const FieldStore::Style* style =
+      pinned_snapshot_->fields.FindStyle(field.style());
+  if (style != nullptr) {
+    background = style->background;
+    object = style->object;
+    if (style->label.find('{') == std::string::npos) {
+      text = &style->label;
+    } else {
+      style_label = FieldStore::ExpandLabel(style->label, x, y);
+      text = &style_label;
+    }
+  } else {
+    if (field.has_value()) {
+      const Snapshot& snapshot = *pinned_snapshot_;
+      background = snapshot.colormap->Color(
+          (field.value() - snapshot.value_min) /
+          (snapshot.value_max - snapshot.value_min));
+    } else {
+      background = field.background();
+    }
+    object = field.object();
+    text = &pinned_snapshot_->fields.FieldLabel(field.label(), x, y,
+                                                style_label);
+  }
+  if (text->empty() and pinned_snapshot_->label_provider != nullptr and
+      drawing_scale_ >= options().LabelProviderMinScale()) {
+    // Chunks of a 4 x 4 block go to different shards.  Other threads may drop
+    // the cached label, so it is copied under the lock.
+    const uint32_t chunk_x = FieldStore::ChunkCoordinate(x);
+    const uint32_t chunk_y = FieldStore::ChunkCoordinate(y);
+    LabelCacheShard& shard =
+        label_cache_shards_[(chunk_x + chunk_y * 4) % kLabelCacheShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    provider_label = shard.cache.Get(pinned_snapshot_->label_provider, x, y,
+                                     FieldStamp(field));
+    text = &provider_label;
+  }
 }
 
 void Controller::FieldClick(int x, int y, int button) {
@@ -190,12 +759,61 @@ void Controller::Draw(double width, double height,
   }
 }
 
+void Controller::DrawShapes(const Board& board, double tx, double ty,
+                            double scale,
+                            const Cairo::RefPtr<Cairo::Context>& context) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  context->set_line_cap(Cairo::LINE_CAP_ROUND);
+  context->set_line_join(Cairo::LINE_JOIN_ROUND);
+  for (const auto& entry : shapes_) {
+    const Shape& shape = entry.second;
+    if (shape.points.empty()) {
+      continue;
+    }
+    std::vector<std::pair<double, double>> points;
+    points.reserve(shape.points.size());
+    for (const auto& point : shape.points) {
+      const auto center = board.CenterOfField(point.first, point.second);
+      points.emplace_back(center.first * scale + tx,
+                          center.second * scale + ty);
+    }
+    context->move_to(points[0].first, points[0].second);
+    for (size_t i = 1; i < points.size(); i++) {
+      context->line_to(points[i].first, points[i].second);
+    }
+    if (shape.arrow and points.size() >= 2) {
+      const auto& tip = points.back();
+      const auto& tail = points[points.size() - 2];
+      const double angle =
+          std::atan2(tip.second - tail.second, tip.first - tail.first);
+      const double length = std::max(10.0, 4 * shape.width);
+      for (double side : {-0.45, 0.45}) {
+        context->move_to(tip.first, tip.second);
+        context->line_to(tip.first - length * std::cos(angle + side),
+                         tip.second - length * std::sin(angle + side));
+      }
+    }
+    context->set_source_rgb(GetDoubleR(shape.color), GetDoubleG(shape.color),
+                            GetDoubleB(shape.color));
+    context->set_line_width(shape.width);
+    context->stroke();
+  }
+}
+
 bool Controller::IsInitialized() const {
   return options_ != nullptr and viewer_ != nullptr and painter_ != nullptr;
 }
 
 void Controller::SetOptions(const Options* options) {
+  std::lock_guard<std::mutex> lock(mutex_);
   options_ = options;
+  colormap_ = std::make_shared<Colormap>(options->FieldColormap());
+  assert(options->FieldValueMin() < options->FieldValueMax());
+  value_min_ = options->FieldValueMin();
+  value_max_ = options->FieldValueMax();
+  index_fields_ = options->IndexFields();
+  RebuildIndexes();
+  PublishSnapshot();
 }
 
 void Controller::SetViewer(Viewer* viewer) {
@@ -218,32 +836,483 @@ Painter& Controller::painter() {
   return *painter_;
 }
 
-void Controller::InvalidateField(int x, int y) {
+void Controller::InvalidateField(int x, int y, LayerMask layers) {
   if (!IsInitialized()) {
     return;
   }
-  painter().InvalidateField(x, y);
+  painter().InvalidateField(x, y, layers);
 }
 
-void Controller::InvalidateEverything() {
+void Controller::InvalidateFields(
+    const std::vector<std::pair<int, int>>& fields, LayerMask layers) {
+  if (!IsInitialized() or fields.empty()) {
+    return;
+  }
+  painter().InvalidateFields(fields, layers);
+}
+
+void Controller::InvalidateEverything(LayerMask layers) {
   if (!IsInitialized()) {
     return;
   }
-  painter().InvalidateEverything();
+  painter().InvalidateEverything(layers);
 }
 
-Controller::Field* Controller::GetField(int x, int y, bool force) {
-  auto it = fields_.find(std::make_pair(x, y));
-  if (it == fields_.end()) {
-    if (!force) {
-      return nullptr;
-    }
+LayerMask Controller::SetFieldColorLocked(int x, int y, int color) {
+  bool created;
+  FieldStore::FieldRef field = GetField(x, y, true /* force */, &created);
+  const LayerMask layers =
+      LayerBit(Layer::kTerrain) | MarkUpdated(field, created);
+  fields_.DetachStyle(field, x, y);
+  field.background() = color;
+  field.clear_value();
+  Reindex(x, y, field.view());
+  AppendChange({FieldChange::Kind::kColor, x, y, color});
+  return layers;
+}
+
+LayerMask Controller::SetFieldValueLocked(int x, int y, float value) {
+  bool created;
+  FieldStore::FieldRef field = GetField(x, y, true /* force */, &created);
+  const LayerMask layers =
+      LayerBit(Layer::kTerrain) | MarkUpdated(field, created);
+  fields_.DetachStyle(field, x, y);
+  field.set_value(value);
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  Reindex(x, y, field.view());
+  AppendChange({FieldChange::Kind::kValue, x, y, bits});
+  return layers;
+}
+
+void Controller::SetRegion(int x0, int y0, int width, int height,
+                           const uint32_t* values, int stride, Layer layer) {
+  if (width <= 0 or height <= 0) {
+    return;
+  }
+  static_assert(sizeof(int) == sizeof(uint32_t), "Columns are copied.");
+  const bool colors = (layer == Layer::kTerrain);
+  LayerMask layers = LayerBit(layer);
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
     const int null_color = options().NullColor();
-    Field default_field;
-    default_field.background = MakeColor(null_color, null_color, null_color);
-    default_field.object = MakeObject(Object::kNone, 0, 0, 0);
-    default_field.last_update_time = current_time_;
-    it = fields_.emplace(std::make_pair(x, y), default_field).first;
+    bool fogged = false;
+    const int64_t created = fields_.ForEachRunInRegion(
+        x0, y0, width, height,
+        MakeColor(null_color, null_color, null_color),
+        MakeObject(Object::kNone, 0, 0, 0), current_time_,
+        [this, x0, y0, values, stride, colors, &fogged](
+            FieldStore::Chunk& chunk, int index, int length,
+            int x, int y) -> void {
+          for (int i = 0; i < length; i++) {
+            if (chunk.style[index + i] != 0) {
+              fields_.DetachStyle(FieldStore::FieldRef(&chunk, index + i),
+                                  x + i, y);
+            }
+          }
+          const uint32_t* source =
+              values + static_cast<int64_t>(y - y0) * stride + (x - x0);
+          std::memcpy((colors ? chunk.background : chunk.object) + index,
+                      source, length * sizeof(uint32_t));
+          if (colors) {
+            chunk.has_value[index >> FieldStore::kChunkBits] &=
+                ~((length == FieldStore::kChunkSize
+                       ? ~uint64_t(0) : (uint64_t(1) << length) - 1)
+                  << (index & (FieldStore::kChunkSize - 1)));
+          }
+          if (index_fields_) {
+            for (int i = 0; i < length; i++) {
+              Reindex(x + i, y, FieldStore::FieldView(&chunk, index + i));
+            }
+          }
+          int64_t* times = chunk.last_update_time + index;
+          for (int i = 0; i < length; i++) {
+            fogged = fogged or times[i] < current_time_;
+            times[i] = current_time_;
+          }
+          chunk.max_update_time =
+              std::max(chunk.max_update_time, current_time_);
+        });
+    if (created > 0 or fogged) {
+      layers |= LayerBit(Layer::kOverlay);
+    }
+    if (label_provider_ != nullptr) {
+      layers |= LayerBit(Layer::kLabels);
+    }
+    min_x_ = std::min(min_x_, x0);
+    max_x_ = std::max(max_x_, x0 + width - 1);
+    min_y_ = std::min(min_y_, y0);
+    max_y_ = std::max(max_y_, y0 + height - 1);
+    // Readers of the journal get their own copy of the rectangle, since
+    // @values belongs to the caller.
+    std::shared_ptr<std::vector<uint32_t>> copy =
+        std::make_shared<std::vector<uint32_t>>();
+    copy->reserve(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++) {
+      const uint32_t* row = values + static_cast<int64_t>(y) * stride;
+      copy->insert(copy->end(), row, row + width);
+    }
+    AppendChange({colors ? FieldChange::Kind::kColorRegion
+                         : FieldChange::Kind::kObjectRegion,
+                  x0, y0,
+                  static_cast<int64_t>(
+                      (static_cast<uint64_t>(width) << 32) | height),
+                  std::move(copy)});
+    PageOutColdChunks();
+    PublishSnapshot();
+  }
+  // Like @InvalidateEverything(), without the lock.
+  if (IsInitialized()) {
+    painter().InvalidateRegion(x0, y0, x0 + width - 1, y0 + height - 1,
+                               layers);
+  }
+}
+
+LayerMask Controller::SetObjectLocked(int x, int y, int object) {
+  bool created;
+  FieldStore::FieldRef field = GetField(x, y, true /* force */, &created);
+  const LayerMask layers =
+      LayerBit(Layer::kObjects) | MarkUpdated(field, created);
+  fields_.DetachStyle(field, x, y);
+  field.object() = object;
+  Reindex(x, y, field.view());
+  AppendChange({FieldChange::Kind::kObject, x, y, object});
+  return layers;
+}
+
+LayerMask Controller::SetTextLocked(int x, int y, const std::string& text) {
+  bool created;
+  FieldStore::FieldRef field = GetField(x, y, true /* force */, &created);
+  const LayerMask layers =
+      LayerBit(Layer::kLabels) | MarkUpdated(field, created);
+  fields_.DetachStyle(field, x, y);
+  field.label() = fields_.InternLabel(text);
+  Reindex(x, y, field.view());
+  AppendChange({FieldChange::Kind::kText, x, y, field.label()});
+  return layers;
+}
+
+LayerMask Controller::SetStyleLocked(int x, int y, int id) {
+  bool created;
+  FieldStore::FieldRef field = GetField(x, y, true /* force */, &created);
+  const LayerMask layers =
+      LayerBit(Layer::kTerrain) | LayerBit(Layer::kObjects) |
+      LayerBit(Layer::kLabels) | MarkUpdated(field, created);
+  if (id == 0) {
+    fields_.DetachStyle(field, x, y);
+  } else {
+    assert(0 < id and id <= FieldStore::kMaxStyle);
+    field.style() = id;
+    field.clear_value();
+  }
+  Reindex(x, y, field.view());
+  AppendChange({FieldChange::Kind::kStyle, x, y, id});
+  return layers;
+}
+
+LayerMask Controller::MarkUpdated(FieldStore::FieldRef& field, bool created) {
+  const bool fogged = field.last_update_time() < current_time_;
+  field.set_last_update_time(current_time_);
+  LayerMask layers = (created or fogged) ? LayerBit(Layer::kOverlay) : 0;
+  if (label_provider_ != nullptr) {
+    // The label depends on the rest of the field.
+    layers |= LayerBit(Layer::kLabels);
+  }
+  return layers;
+}
+
+void Controller::AppendChange(const FieldChange& change) {
+  journal_.Append(change);
+  if (recorder_ != nullptr) {
+    recorder_->ReadJournal(journal_, fields_);
+    RecordKeyframeIfNeeded();
+  }
+}
+
+void Controller::RecordKeyframeIfNeeded() {
+  if (recorder_->NeedsKeyframe()) {
+    recorder_->Keyframe(
+        fields_,
+        BoardFileInfo{current_time_, min_x_, max_x_, min_y_, max_y_});
+  }
+}
+
+void Controller::ReplaceBoard(const FieldStore& fields,
+                              const BoardFileInfo& info) {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fields_ = fields;
+    RebuildIndexes();
+    DropHistory();
+    current_time_ = info.current_time;
+    min_x_ = info.min_x;
+    max_x_ = info.max_x;
+    min_y_ = info.min_y;
+    max_y_ = info.max_y;
+    journal_.Append({FieldChange::Kind::kClear, 0, 0, 0});
+    if (recorder_ != nullptr) {
+      // The keyframe stands for the change.
+      recorder_->Keyframe(fields_, info);
+      recorder_->SetJournalCursor(journal_.End());
+    }
+    PublishSnapshot();
+  }
+  InvalidateEverything();
+}
+
+void Controller::Reindex(int x, int y, FieldStore::FieldView field) {
+  if (!index_fields_) {
+    return;
+  }
+  if (field.style() != 0) {
+    object_index_.Erase(x, y);
+    color_index_.Erase(x, y);
+    style_index_.Set(x, y, field.style());
+    return;
+  }
+  style_index_.Erase(x, y);
+  const int type = (field.object() >> 24) & 255;
+  if (type != static_cast<int>(Object::kNone)) {
+    object_index_.Set(x, y, type);
+  } else {
+    object_index_.Erase(x, y);
+  }
+  if (!field.has_value()) {
+    color_index_.Set(x, y, field.background());
+  } else {
+    color_index_.Erase(x, y);
+  }
+}
+
+void Controller::RebuildIndexes() {
+  object_index_.Clear();
+  color_index_.Clear();
+  style_index_.Clear();
+  if (!index_fields_) {
+    return;
+  }
+  fields_.ForEachInRect(
+      std::numeric_limits<int>::min(), std::numeric_limits<int>::min(),
+      std::numeric_limits<int>::max(), std::numeric_limits<int>::max(),
+      [this](int x, int y, FieldStore::FieldView field) -> void {
+        Reindex(x, y, field);
+      });
+}
+
+void Controller::FindStyled(const std::function<bool(int, int, bool)>& matches,
+                            std::vector<std::pair<int, int>>& found) {
+  // A pure read: the const lookup doesn't copy chunks shared with the
+  // snapshot.
+  const FieldStore& store = fields_;
+  for (uint32_t id : style_index_.Keys()) {
+    const std::vector<std::pair<int, int>>& fields = style_index_.Find(id);
+    const FieldStore::Style* style = store.FindStyle(id);
+    if (style != nullptr) {
+      if (matches(style->background, style->object, false)) {
+        found.insert(found.end(), fields.begin(), fields.end());
+      }
+      continue;
+    }
+    for (const std::pair<int, int>& field : fields) {
+      const FieldStore::FieldView view =
+          store.Find(field.first, field.second);
+      if (matches(view.background(), view.object(), view.has_value())) {
+        found.push_back(field);
+      }
+    }
+  }
+}
+
+void Controller::RememberTurn() {
+  if (options_ == nullptr or options().HistoryLength() <= 0) {
+    DropHistory();
+    return;
+  }
+  PublishSnapshot();
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&snapshot_);
+  if (!history_.empty()) {
+    history_.back().fields = newest_turn_->fields.DiffFrom(snapshot->fields);
+  }
+  history_.push_back(Turn{
+      FieldStore::Delta(), snapshot->current_time, snapshot->min_x,
+      snapshot->max_x, snapshot->min_y, snapshot->max_y, snapshot->colormap,
+      snapshot->value_min, snapshot->value_max, snapshot->label_provider});
+  newest_turn_ = std::move(snapshot);
+  bool shown_forgotten = false;
+  while (history_.size() > static_cast<size_t>(options().HistoryLength())) {
+    history_.pop_front();
+    if (history_position_ > 0) {
+      history_position_--;
+    } else if (history_position_ == 0) {
+      shown_forgotten = true;
+    }
+  }
+  if (shown_forgotten) {
+    // The oldest turn left is shown instead.
+    const std::shared_ptr<const Snapshot> shown_before =
+        std::atomic_load(&shown_turn_);
+    const std::shared_ptr<const Snapshot> shown = TurnSnapshot(0);
+    std::atomic_store(&shown_turn_, shown);
+    InvalidateDifferences(*shown_before, *shown);
+  }
+}
+
+void Controller::DropHistory() {
+  history_.clear();
+  newest_turn_.reset();
+  history_position_ = -1;
+  if (std::atomic_load(&shown_turn_) != nullptr) {
+    std::atomic_store(&shown_turn_, std::shared_ptr<const Snapshot>());
+    InvalidateEverything();
+  }
+}
+
+std::shared_ptr<const Controller::Snapshot> Controller::TurnSnapshot(
+    int64_t index) const {
+  const int64_t newest = static_cast<int64_t>(history_.size()) - 1;
+  if (index == newest) {
+    return newest_turn_;
+  }
+  const Turn& turn = history_[index];
+  std::shared_ptr<Snapshot> snapshot(new Snapshot{
+      newest_turn_->fields, turn.current_time, turn.min_x, turn.max_x,
+      turn.min_y, turn.max_y, turn.colormap, turn.value_min, turn.value_max,
+      turn.label_provider});
+  for (int64_t i = newest - 1; i >= index; i--) {
+    snapshot->fields.Patch(history_[i].fields);
+  }
+  return snapshot;
+}
+
+void Controller::InvalidateDifferences(const Snapshot& from,
+                                       const Snapshot& to) {
+  // Fields of changed chunks are redrawn whole, also those that exist on one
+  // of the boards only.
+  std::vector<std::pair<int, int>> changed;
+  const auto add = [&changed](int x, int y, FieldStore::FieldView) -> void {
+    changed.emplace_back(x, y);
+  };
+  from.fields.ForEachDifferentChunk(
+      to.fields,
+      [&from, &to, &add](int chunk_x, int chunk_y) -> void {
+        const int x0 = chunk_x * FieldStore::kChunkSize;
+        const int y0 = chunk_y * FieldStore::kChunkSize;
+        const int x1 = x0 + FieldStore::kChunkSize - 1;
+        const int y1 = y0 + FieldStore::kChunkSize - 1;
+        from.fields.ForEachInRect(x0, y0, x1, y1, add);
+        to.fields.ForEachInRect(x0, y0, x1, y1, add);
+      });
+  InvalidateFields(changed, kAllLayers);
+  // In the shared chunks, the fields of the older board have times up to
+  // its own, so only the fields updated in its very turn change their fog.
+  const Snapshot& older = from.current_time < to.current_time ? from : to;
+  const Snapshot& newer = from.current_time < to.current_time ? to : from;
+  if (older.current_time == newer.current_time) {
+    return;
+  }
+  std::vector<std::pair<int, int>> fogged;
+  older.fields.ForEachFieldUpdatedAt(
+      older.current_time,
+      [&fogged](int x, int y) -> void {
+        fogged.emplace_back(x, y);
+      });
+  InvalidateFields(fogged, LayerBit(Layer::kOverlay));
+}
+
+void Controller::PublishSnapshot() {
+  std::shared_ptr<const Snapshot> snapshot(new Snapshot{
+      fields_, current_time_, min_x_, max_x_, min_y_, max_y_,
+      colormap_, value_min_, value_max_, label_provider_});
+  std::atomic_store(&snapshot_, std::move(snapshot));
+  snapshot_outdated_.store(false);
+}
+
+void Controller::PageOutColdChunks() {
+  if (options_ == nullptr or options().ChunkMemoryBudget() <= 0) {
+    return;
+  }
+  // One chunk of margin, so that scrolling doesn't read chunks back right
+  // away.
+  const int min_chunk_x =
+      FieldStore::ChunkCoordinate(viewport_min_x_.load()) - 1;
+  const int min_chunk_y =
+      FieldStore::ChunkCoordinate(viewport_min_y_.load()) - 1;
+  const int max_chunk_x =
+      FieldStore::ChunkCoordinate(viewport_max_x_.load()) + 1;
+  const int max_chunk_y =
+      FieldStore::ChunkCoordinate(viewport_max_y_.load()) + 1;
+  if (pager_ != nullptr) {
+    // The painter needs these chunks in every snapshot.  Read back into the
+    // board once, they are shared by the snapshots instead of being read
+    // from the spill file for each of them.
+    fields_.PageIn(min_chunk_x, min_chunk_y, max_chunk_x, max_chunk_y);
+  }
+  const int64_t max_resident = std::max<int64_t>(
+      1, options().ChunkMemoryBudget() / sizeof(FieldStore::Chunk));
+  if (spilling_failed_ or fields_.ResidentChunks() <= max_resident) {
+    return;
+  }
+  if (pager_ == nullptr) {
+    pager_ = ChunkPager::Create(options().SpillDirectory());
+    if (pager_ == nullptr) {
+      spilling_failed_ = true;
+      return;
+    }
+  }
+  // Goes an eighth below the budget, so that not every publication pages
+  // out.
+  if (!fields_.PageOut(
+          *pager_, max_resident - max_resident / 8,
+          [=](int chunk_x, int chunk_y) -> bool {
+            return min_chunk_x <= chunk_x and chunk_x <= max_chunk_x and
+                   min_chunk_y <= chunk_y and chunk_y <= max_chunk_y;
+          })) {
+    // Not tried again, so that a full disk isn't hit at every batch.
+    spilling_failed_ = true;
+  }
+}
+
+void Controller::SetViewport(int min_x, int min_y, int max_x, int max_y) {
+  viewport_min_x_.store(min_x);
+  viewport_min_y_.store(min_y);
+  viewport_max_x_.store(max_x);
+  viewport_max_y_.store(max_y);
+}
+
+void Controller::SetVisibleRegion(const VisibleRegion& region) {
+  std::function<void(const VisibleRegion&)> copy;
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(visible_region_mutex_);
+    if (region.min_x == visible_region_.min_x and
+        region.min_y == visible_region_.min_y and
+        region.max_x == visible_region_.max_x and
+        region.max_y == visible_region_.max_y and
+        region.scale == visible_region_.scale) {
+      return;
+    }
+    visible_region_ = region;
+    copy = on_viewport_changed_callback_;
+  }
+  copy(region);
+}
+
+FieldStore::FieldRef Controller::GetField(int x, int y, bool force,
+                                          bool* created_field) {
+  if (!force) {
+    if (created_field != nullptr) {
+      *created_field = false;
+    }
+    return fields_.Find(x, y);
+  }
+  const int null_color = options().NullColor();
+  bool created;
+  FieldStore::FieldRef field = fields_.FindOrCreate(
+      x, y, MakeColor(null_color, null_color, null_color),
+      MakeObject(Object::kNone, 0, 0, 0), current_time_, created);
+  if (created_field != nullptr) {
+    *created_field = created;
+  }
+  if (created) {
     if (x < min_x_) {
       min_x_ = x;
     }
@@ -257,7 +1326,7 @@ Controller::Field* Controller::GetField(int x, int y, bool force) {
       max_y_ = y;
     }
   }
-  return &(it->second);
+  return field;
 }
 
 }  // namespace Grid
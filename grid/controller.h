@@ -1,15 +1,25 @@
 #ifndef GRID_CONTROLLER_H_
 #define GRID_CONTROLLER_H_
 
+#include <atomic>
 #include <cairomm/context.h>
 #include <cairomm/refptr.h>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
-
+#include <utility>
+#include <vector>
+
+#include "board_file.h"
+#include "change_journal.h"
+#include "field_index.h"
+#include "field_store.h"
+#include "label_cache.h"
+#include "layer.h"
 #include "message_box.h"
 #include "object.h"
 #include "single_message_box.h"
@@ -18,8 +28,11 @@
 namespace Grid {
 
 class Board;
+class Colormap;
 class Options;
 class Painter;
+class Recorder;
+class Replay;
 class Viewer;
 
 int MakeColor(int r, int g, int b);
@@ -31,7 +44,7 @@ double GetDoubleB(int color);
 class Controller {
  public:
   Controller();
-  virtual ~Controller() = default;
+  virtual ~Controller();
 
   // You -> Board.
   // -------------
@@ -39,33 +52,268 @@ class Controller {
   void Clear();
 
   void SetFieldColor(int x, int y, int r, int g, int b);
+  // The field is colored with the colormap (see Options::FieldColormap()),
+  // until its color is set with @SetFieldColor().
+  void SetFieldValue(int x, int y, float value);
   void SetObject(int x, int y, Object object, int r, int g, int b);
   StreamReader SetText(int x, int y);
   void SetFog();
 
+  // Set the colors (made with MakeColor()) or the objects (made with
+  // MakeObject()) of the rectangle [x0, x0 + width) x [y0, y0 + height) from
+  // a buffer: field (x0 + i, y0 + j) gets @values[j * stride + i].  Rows are
+  // copied straight into the storage under a single lock, and the rectangle
+  // is redrawn at once.  The journal keeps a copy of the rectangle for its
+  // readers (see @journal()).
+  void SetRegionColors(int x0, int y0, int width, int height,
+                       const uint32_t* values, int stride);
+  void SetRegionObjects(int x0, int y0, int width, int height,
+                        const uint32_t* values, int stride);
+
+  // A style is a look shared by many fields: a color, an object and a label,
+  // in which "{x}" and "{y}" stand for the coordinates of the field.  Fields
+  // set to a style with @SetStyle() store only its id and are drawn with its
+  // current definition, so redefining a style redraws all of them with a
+  // single call.  Ids are in range [1, 65535].  Setting the color, value,
+  // object or text of a styled field detaches it from the style; the rest of
+  // its look stays as the style had it.
+  void DefineStyle(int id, int r, int g, int b, Object object, int object_r,
+                   int object_g, int object_b, const std::string& label);
+  // @id 0 detaches the field from its style.
+  void SetStyle(int x, int y, int id);
+
+  // Labels of fields without their own text (or the text of their style)
+  // are made by @provider, e.g.
+  //
+  //   controller->SetLabelProvider(
+  //       [](int x, int y, Grid::StreamReader& label) -> void {
+  //         label << "(" << x << ", " << y << ")";
+  //       });
+  //
+  // It is called by the drawing threads, only for the fields being drawn
+  // and only when the fields are at least Options::LabelProviderMinScale()
+  // pixels large.  Threads drawing different parts of the board may call it
+  // at once, for different fields.  Labels are cached and made again when
+  // anything else about the field changes, so @provider must be a function
+  // of the coordinates and of the rest of the field.  It mustn't call the
+  // controller.  Setting a new provider (nullptr for none) drops all the
+  // labels.
+  void SetLabelProvider(LabelCache::Provider provider);
+
+  // Shapes drawn over the fields, e.g. planned paths.  They are kept apart
+  // from the fields, so setting, replacing or removing one redraws no field,
+  // only the window.  Points are fields; lines go through their centers.
+  // Widths are in pixels.  A shape replaces the previous shape with the same
+  // @id.  Shapes are not recorded, and @Clear() removes them.
+  void SetPolyline(int id, const std::vector<std::pair<int, int>>& points,
+                   int r, int g, int b, double width);
+  // A line from @from to @to with a head at @to.
+  void SetArrow(int id, std::pair<int, int> from, std::pair<int, int> to,
+                int r, int g, int b, double width);
+  void RemoveShape(int id);
+
+  // Change the coloring of field values and redraw the fields.
+  void SetColormap(const Colormap& colormap);
+  // @min must be smaller than @max.
+  void SetValueRange(float min, float max);
+
   void CenterOn(int x, int y);
 
+  // Saves all the fields to a binary file.  Returns false on I/O errors.
+  bool SaveSnapshot(const std::string& path);
+  // Replaces the board with the one saved by @SaveSnapshot().  The file is
+  // mapped into memory and fields are read from the disk when they are used,
+  // so loading takes time in proportion to the number of chunks and labels,
+  // not fields.  Returns false (and leaves the board intact) when the file
+  // can't be loaded.
+  bool LoadSnapshot(const std::string& path);
+
+  // Records the board and every following call to the methods of this
+  // section (batches included) to a log, which can be played back with
+  // Replay.  Replaces the previous recording, if any.  Returns false when the
+  // file can't be created.
+  bool StartRecording(const std::string& path);
+  // Returns false when the recording could not be written completely.
+  bool StopRecording();
+
+  // Applies many field changes under a single lock and notifies the painter
+  // once, when the batch is destroyed.  The painter sees either none or all of
+  // the changes of a batch.  No other method of the controller may be called
+  // by the same thread while the batch is alive.
+  //
+  //   {
+  //     Controller::Batch batch(controller);
+  //     batch.SetFieldColor(x, y, 255, 0, 0);
+  //     batch.SetText(x, y) << "Field " << x << " " << y;
+  //   }
+  class Batch {
+   public:
+    explicit Batch(Controller* controller);
+    ~Batch();
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    void SetFieldColor(int x, int y, int r, int g, int b);
+    void SetFieldValue(int x, int y, float value);
+    void SetObject(int x, int y, Object object, int r, int g, int b);
+    StreamReader SetText(int x, int y);
+    void SetStyle(int x, int y, int id);
+
+   private:
+    void AddChangedField(int x, int y, LayerMask layers);
+
+    Controller* controller_;
+    std::unique_lock<std::mutex> lock_;
+    // Changed fields, per layer.
+    std::vector<std::pair<int, int>> changed_fields_[kNumberOfLayers];
+  };
+
   StreamReader AddMessage();
 
   void AddSingleMessageBox(double r, double g, double b, double a,
                            std::function<void(StreamReader&)> generator);
 
+  // All field changes, in order.  Any number of consumers can follow the
+  // journal, each with its own cursor, without slowing down the setters;
+  // the recorder (see @StartRecording()) is one of them.
+  const ChangeJournal& journal() const;
+  // Resolves the value of a FieldChange::Kind::kText change.  Ids are valid
+  // until the next FieldChange::Kind::kClear change.
+  std::string GetLabel(uint32_t id);
+
   void OnFieldClick(std::function<void(int x, int y, int button)> callback);
   void OnKeyPress(std::function<void(const std::string&)> callback);
 
 
+  // Board -> You.
+  // -------------
+
+  // A field as set by the methods above.
+  struct FieldState {
+    int x, y;
+    // Made with MakeColor(), as set by @SetFieldColor() or by the style.
+    int color;
+    // Set by @SetFieldValue(); then the field is drawn with the colormap
+    // rather than with @color.
+    bool has_value;
+    float value;
+    // Made with MakeObject().
+    int object;
+    // Valid during the call only.
+    const std::string* text;
+    // Id of the style of the field, 0 for none.
+    int style;
+    // Not updated since the last @SetFog().
+    bool fog;
+  };
+
+  // Calls @visitor for every existing field in the rectangle
+  // [x0, x1] x [y0, y1], straight from the storage of the board: chunk by
+  // chunk of 64 x 64 fields (the rows of chunks from the top), row by row
+  // inside a chunk.  Empty parts of the board cost nothing.  The controller
+  // is locked meanwhile, so @visitor mustn't call it.
+  void ForEachInRect(int x0, int y0, int x1, int y1,
+                     const std::function<void(const FieldState&)>& visitor);
+  // Returns the number of existing fields in the rectangle for which
+  // @predicate returns true.
+  int64_t CountWhere(int x0, int y0, int x1, int y1,
+                     const std::function<bool(const FieldState&)>& predicate);
+
+  // Return the coordinates of all the fields with an object of type @object,
+  // drawn in the color (r, g, b) or set to the style @id, in no particular
+  // order.  Styled fields are found by the current definition of their
+  // style; fields with a value are not found by color, and Object::kNone
+  // finds nothing.  With Options::IndexFields() it takes time proportional
+  // to the number of fields found (and of styles in use), otherwise the
+  // whole board is scanned.
+  std::vector<std::pair<int, int>> FindObjects(Object object);
+  std::vector<std::pair<int, int>> FindColor(int r, int g, int b);
+  std::vector<std::pair<int, int>> FindStyle(int id);
+
+  // A state of the board, e.g. at some turn or at the end of a run.  It
+  // shares the chunks of fields with the board until they change, so it is
+  // cheap to save and to keep.
+  class State {
+   public:
+    State();
+
+   private:
+    friend class Controller;
+
+    std::shared_ptr<const FieldStore> fields_;
+  };
+
+  // Returns the current state of the board.
+  State SaveState();
+  // Reads a board saved with @SaveSnapshot().  Returns false when the file
+  // can't be loaded.
+  static bool LoadState(const std::string& path, State& state);
+
+  // Returns the coordinates of the fields that differ between the states, in
+  // no particular order: fields that exist in only one of them, or differ in
+  // color, value, object, text or style id.  Fog is not compared.  Chunks of
+  // fields are compared by hashes, and only the ones that differ are
+  // compared field by field, so the time depends on the number of changed
+  // chunks rather than on the size of the board.
+  static std::vector<std::pair<int, int>> Diff(const State& a,
+                                               const State& b);
+
+  // Number of failed reads of the chunks of fields paged out to the spill
+  // file (see Options::ChunkMemoryBudget()).  While a chunk can't be read
+  // back, its fields are missing from the board and changes to them are
+  // dropped; it is read again on the next access, and its fields in the file
+  // are kept.
+  int64_t SpillReadErrors();
+
+  // The part of the board shown in the window.
+  struct VisibleRegion {
+    // Fields in [min_x, max_x] x [min_y, max_y] may be visible, the others
+    // are not.  Empty (@min_x > @max_x) until the window is shown.
+    int min_x, min_y, max_x, max_y;
+    // Size of a field in pixels.
+    double scale;
+  };
+
+  // Fields outside of the region can be updated less often without the
+  // viewer noticing.
+  VisibleRegion GetVisibleRegion();
+  // @callback is called whenever the window is scrolled, zoomed or resized,
+  // by the drawing thread.  It should only note the region for the user
+  // thread, and mustn't call the controller.
+  void OnViewportChanged(std::function<void(const VisibleRegion&)> callback);
+
+
   // Board -> Controller -> Board.
   // ----------------------
 
+  // Makes @GetExtensions() and @GetFieldInfo() read the most recently
+  // published state of the board, without locking.  Must be called by the
+  // painter thread before it draws.
+  void PinSnapshot();
+
   void GetExtensions(int& min_x, int& min_y, int& max_x, int& max_y);
 
+  // Calls @callback(x, y) for every field of the pinned snapshot in
+  // [x0, x1] x [y0, y1].  Empty parts of the board are skipped a chunk of
+  // fields at a time.
+  void ForEachPinnedField(int x0, int y0, int x1, int y1,
+                          const std::function<void(int, int)>& callback);
+
+  // @text points to an interned label, which stays valid until the next call
+  // to @PinSnapshot(), or to a label of a style or of the label provider,
+  // which stays valid until the next call to @GetFieldInfo() by the same
+  // thread.  Between pins, any number of drawing threads can call it at
+  // once.
   void GetFieldInfo(int x, int y, bool& border, int& background, int& object,
-                    std::string& text, bool& fog);
+                    const std::string*& text, bool& fog);
 
   void FieldClick(int x, int y, int button);
   void KeyPress(const std::string& key);
 
  private:
+  friend class Painter;
+  friend class Replay;
   friend class Viewer;
   friend int RunBoard(int argc, char** argv,
                       const Options& options, std::unique_ptr<Board> board,
@@ -73,6 +321,10 @@ class Controller {
 
   void Draw(double width, double height,
             const Cairo::RefPtr<Cairo::Context>& context);
+  // Draws the shapes for the viewer.  Point (x, y) of the board is at
+  // (x * scale + tx, y * scale + ty) in @context.
+  void DrawShapes(const Board& board, double tx, double ty, double scale,
+                  const Cairo::RefPtr<Cairo::Context>& context);
 
   bool IsInitialized() const;
 
@@ -94,26 +346,207 @@ class Controller {
   MessageBox main_message_box_;
   std::vector<SingleMessageBox> single_message_boxes_;
 
+  struct Shape {
+    std::vector<std::pair<int, int>> points;
+    int color;
+    double width;
+    // With a head at the last point.
+    bool arrow;
+  };
+  // Shapes by id.
+  std::map<int, Shape> shapes_;
+  // Requires no lock.  Replaces the shape and redraws the window.
+  void SetShape(int id, Shape shape);
+
   std::function<void(int, int, int)> on_field_click_callback_;
   std::function<void(const std::string&)> on_key_press_callback_;
 
-  void InvalidateField(int x, int y);
-  void InvalidateEverything();
-
-  struct Field {
-    int background;
-    int object;
-    std::string text;
-    int64_t last_update_time;
-  };
+  // @InvalidateField() and @InvalidateFields() require a lock, which
+  // serializes the calls to the painter.  The changes must already be visible
+  // to the painter, i.e. published or marked as outdated.
+  void InvalidateField(int x, int y, LayerMask layers);
+  void InvalidateFields(const std::vector<std::pair<int, int>>& fields,
+                        LayerMask layers);
+  void InvalidateEverything(LayerMask layers = kAllLayers);
+
+  // These require a lock.  They return the layers of the field that have to
+  // be redrawn.
+  LayerMask SetFieldColorLocked(int x, int y, int color);
+  LayerMask SetFieldValueLocked(int x, int y, float value);
+  // Writes the background (@layer == Layer::kTerrain) or the object
+  // (@layer == Layer::kObjects) column of a rectangle, takes the lock.
+  void SetRegion(int x0, int y0, int width, int height,
+                 const uint32_t* values, int stride, Layer layer);
+  LayerMask SetObjectLocked(int x, int y, int object);
+  LayerMask SetTextLocked(int x, int y, const std::string& text);
+  LayerMask SetStyleLocked(int x, int y, int id);
+  // Used by @DefineStyle() and by Replay.
+  void DefineStyle(int id, const FieldStore::Style& style);
+  // Requires a lock.  Sets the last update time of the field to now; the
+  // border appears on a new field and the fog disappears from a fogged one.
+  // Returns the layers to redraw for that, plus the labels when they are
+  // made by a label provider, which sees the whole field.
+  LayerMask MarkUpdated(FieldStore::FieldRef& field, bool created);
 
   int64_t current_time_;
 
+  // Replaces the board with @fields.  Must be called without a lock.
+  void ReplaceBoard(const FieldStore& fields, const BoardFileInfo& info);
+
   // Requires a lock.
-  Field* GetField(int x, int y, bool force);
+  FieldStore::FieldRef GetField(int x, int y, bool force,
+                                bool* created = nullptr);
+
+  // Require a lock.  @Reindex() is called after every change of a field;
+  // @RebuildIndexes() after the board is replaced.  Both do nothing when the
+  // fields are not indexed.
+  void Reindex(int x, int y, FieldStore::FieldView field);
+  void RebuildIndexes();
+  // Requires a lock.  Appends the styled fields for which
+  // @matches(background, object, has_value) returns true, as they are drawn:
+  // with the look of their style, or with their own columns when the style
+  // is not defined.
+  void FindStyled(const std::function<bool(int, int, bool)>& matches,
+                  std::vector<std::pair<int, int>>& found);
 
   int min_x_, max_x_, min_y_, max_y_;
-  std::map<std::pair<int, int>, Field> fields_;
+  FieldStore fields_;
+
+  // Set from Options::IndexFields().
+  bool index_fields_;
+  // Fields without a style, by the type of their object (Object::kNone
+  // excluded) and by their color (fields with a value excluded).
+  FieldIndex object_index_;
+  FieldIndex color_index_;
+  // Styled fields, by style id.
+  FieldIndex style_index_;
+
+  // Null when there is none.  Shared with snapshots.
+  std::shared_ptr<const LabelCache::Provider> label_provider_;
+
+  // Coloring of field values.  The colormap is immutable and shared with
+  // snapshots.
+  std::shared_ptr<const Colormap> colormap_;
+  float value_min_, value_max_;
+
+  // Written with a lock.
+  ChangeJournal journal_;
+
+  // Null when not recording.  Follows @journal_ with its own cursor.
+  std::unique_ptr<Recorder> recorder_;
+
+  // Requires a lock.  Appends @change to the journal.  The recorder reads it
+  // at once: the change refers to labels and styles by id, and its record
+  // gets the current time.
+  void AppendChange(const FieldChange& change);
+  // Requires a lock.  Writes a keyframe when the recorder asks for it.
+  void RecordKeyframeIfNeeded();
+
+  // A consistent, read-only copy of the board, shared with the painter.
+  struct Snapshot {
+    FieldStore fields;
+    int64_t current_time;
+    int min_x, max_x, min_y, max_y;
+    std::shared_ptr<const Colormap> colormap;
+    float value_min, value_max;
+    std::shared_ptr<const LabelCache::Provider> label_provider;
+  };
+
+  // Requires a lock.
+  void PublishSnapshot();
+
+  // Accessed only with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const Snapshot> snapshot_;
+  // Set when @fields_ has changes that are not published yet.
+  std::atomic<bool> snapshot_outdated_;
+  // Used only by the painter thread.
+  std::shared_ptr<const Snapshot> pinned_snapshot_;
+  // Labels made by the label provider, used by the drawing threads.  The
+  // chunks of the board are spread over shards with their own locks, so
+  // threads drawing different parts of the board don't wait for each other.
+  struct LabelCacheShard {
+    LabelCacheShard();
+
+    std::mutex mutex;
+    LabelCache cache;
+  };
+  static constexpr int kLabelCacheShards = 16;
+  LabelCacheShard label_cache_shards_[kLabelCacheShards];
+  // Size of a field in pixels.  Used only by the painter thread.
+  double drawing_scale_;
+
+  // Called by the painter thread after @PinSnapshot().
+  void SetDrawingScale(double scale);
+
+  // Called by the viewer.  Moves @turns turns back (when negative) or
+  // forward through the history kept by @SetFog() (see
+  // Options::HistoryLength()); moving past the newest turn shows the current
+  // board again.  Only the fields that differ between the two boards are
+  // redrawn.
+  void StepHistory(int turns);
+
+  // Require a lock.  @RememberTurn() is called by @SetFog(), before the fog
+  // covers the fields.
+  void RememberTurn();
+  void DropHistory();
+  // Requires a lock.  Rebuilds the snapshot of turn @index of @history_.
+  std::shared_ptr<const Snapshot> TurnSnapshot(int64_t index) const;
+  // Redraws the fields that may differ between the boards of @from and @to.
+  void InvalidateDifferences(const Snapshot& from, const Snapshot& to);
+
+  // A past turn.  Only the newest turn keeps its whole board; the others
+  // keep the chunks in which their board differs from the board of the next
+  // turn, so the history takes memory for the chunks changed in the turns
+  // rather than for the whole board in every turn.
+  struct Turn {
+    // Turns the fields of the next turn into the fields of this one.  Empty
+    // for the newest turn.
+    FieldStore::Delta fields;
+    // The rest of the snapshot of the turn.
+    int64_t current_time;
+    int min_x, max_x, min_y, max_y;
+    std::shared_ptr<const Colormap> colormap;
+    float value_min, value_max;
+    std::shared_ptr<const LabelCache::Provider> label_provider;
+  };
+
+  // The past turns, the oldest first.
+  std::deque<Turn> history_;
+  // Snapshot of the last turn of @history_, null when it is empty.
+  std::shared_ptr<const Snapshot> newest_turn_;
+  // Index in @history_ of the turn shown, -1 for the current board.
+  int history_position_;
+  // Pinned instead of the current snapshot when not null.  Accessed only
+  // with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const Snapshot> shown_turn_;
+
+  // Requires a lock.  Pages out cold chunks when the board is over its
+  // memory budget, and keeps the chunks around the visible part of the board
+  // in memory.  It reads and writes the spill file, so it is called only by
+  // the user thread, in @SetFog() and at the end of batches and region
+  // uploads, never on the way of the painter.
+  void PageOutColdChunks();
+
+  // Called by the painter whenever the visible part of the board changes:
+  // @SetViewport() with the fields of its surface, which is larger than the
+  // window, and @SetVisibleRegion() with the fields of the window.
+  void SetViewport(int min_x, int min_y, int max_x, int max_y);
+  void SetVisibleRegion(const VisibleRegion& region);
+
+  // Created with the first page out.
+  std::shared_ptr<ChunkPager> pager_;
+  // Set when the spill file can't be created or written.  Chunks already
+  // paged out are still read back, but no more are paged out.
+  bool spilling_failed_;
+  // Fields visible in the window, set by the painter thread.
+  std::atomic<int> viewport_min_x_, viewport_min_y_;
+  std::atomic<int> viewport_max_x_, viewport_max_y_;
+
+  // Guards @visible_region_ and @on_viewport_changed_callback_, so that the
+  // painter doesn't wait for batches.
+  std::mutex visible_region_mutex_;
+  VisibleRegion visible_region_;
+  std::function<void(const VisibleRegion&)> on_viewport_changed_callback_;
 };
 
 }  // namespace Grid
@@ -0,0 +1,80 @@
+#include "dirty_field_set.h"
+
+namespace Grid {
+
+constexpr int DirtyFieldSet::kChunkBits;
+constexpr int DirtyFieldSet::kChunkSize;
+
+DirtyFieldSet::DirtyFieldSet()
+    : chunks_(), last_key_(0), last_chunk_(nullptr), pending_head_(nullptr) {}
+
+bool DirtyFieldSet::Add(int x, int y) {
+  Chunk* chunk = GetChunk(x >> kChunkBits, y >> kChunkBits);
+  const int dx = x & (kChunkSize - 1);
+  const int dy = y & (kChunkSize - 1);
+  const uint64_t bit = uint64_t(1) << dx;
+  if ((chunk->rows[dy].fetch_or(bit) & bit) and
+      (chunk->row_mask.load() >> dy & 1)) {
+    // Already in the set and its row is still marked, so the reader is going
+    // to find it.
+    return false;
+  }
+  chunk->row_mask.fetch_or(uint64_t(1) << dy);
+  if (chunk->pending.exchange(true)) {
+    return false;
+  }
+  Chunk* head = pending_head_.load();
+  do {
+    chunk->next_pending = head;
+  } while (!pending_head_.compare_exchange_weak(head, chunk));
+  return true;
+}
+
+void DirtyFieldSet::Drain(const std::function<void(int, int)>& callback) {
+  Chunk* chunk = pending_head_.exchange(nullptr);
+  while (chunk != nullptr) {
+    // A writer may push the chunk again as soon as @pending is cleared.
+    Chunk* next = chunk->next_pending;
+    chunk->pending.store(false);
+    uint64_t row_mask = chunk->row_mask.exchange(0);
+    const int base_x = chunk->chunk_x * kChunkSize;
+    const int base_y = chunk->chunk_y * kChunkSize;
+    while (row_mask != 0) {
+      const int dy = __builtin_ctzll(row_mask);
+      row_mask &= row_mask - 1;
+      uint64_t row = chunk->rows[dy].exchange(0);
+      while (row != 0) {
+        const int dx = __builtin_ctzll(row);
+        row &= row - 1;
+        callback(base_x + dx, base_y + dy);
+      }
+    }
+    chunk = next;
+  }
+}
+
+DirtyFieldSet::Chunk* DirtyFieldSet::GetChunk(int chunk_x, int chunk_y) {
+  const uint64_t key =
+      (static_cast<uint64_t>(static_cast<uint32_t>(chunk_x)) << 32) |
+      static_cast<uint32_t>(chunk_y);
+  if (last_chunk_ != nullptr and last_key_ == key) {
+    return last_chunk_;
+  }
+  std::unique_ptr<Chunk>& entry = chunks_[key];
+  if (!entry) {
+    entry.reset(new Chunk);
+    entry->chunk_x = chunk_x;
+    entry->chunk_y = chunk_y;
+    entry->row_mask.store(0);
+    for (int i = 0; i < kChunkSize; i++) {
+      entry->rows[i].store(0);
+    }
+    entry->pending.store(false);
+    entry->next_pending = nullptr;
+  }
+  last_key_ = key;
+  last_chunk_ = entry.get();
+  return last_chunk_;
+}
+
+}  // namespace Grid
@@ -0,0 +1,66 @@
+#ifndef GRID_DIRTY_FIELD_SET_H_
+#define GRID_DIRTY_FIELD_SET_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+namespace Grid {
+
+// A set of fields that have to be redrawn, shared between writers, which add
+// fields, and a single reader, which takes them out.  Fields are kept in
+// per-chunk bitmaps: a mask of non-empty rows and a bit per field, so adding
+// the same field many times costs nothing extra.  Chunks with new fields are
+// linked into a list that the reader takes as a whole.
+//
+// Writers never wait for the reader.  However, calls to @Add() must be
+// serialized by the caller.
+class DirtyFieldSet {
+ public:
+  DirtyFieldSet();
+
+  DirtyFieldSet(const DirtyFieldSet&) = delete;
+  DirtyFieldSet& operator=(const DirtyFieldSet&) = delete;
+
+  // --------------------------- WRITER FUNCTIONS --------------------------- //
+
+  // Returns true when the field is the first one added to its chunk since the
+  // reader last visited it, i.e. when the reader may need to be woken up.
+  bool Add(int x, int y);
+
+
+  // --------------------------- READER FUNCTIONS --------------------------- //
+
+  // Calls @callback(x, y) for every added field and removes it from the set.
+  void Drain(const std::function<void(int, int)>& callback);
+
+ private:
+  static constexpr int kChunkBits = 6;
+  static constexpr int kChunkSize = 1 << kChunkBits;
+
+  struct Chunk {
+    int chunk_x;
+    int chunk_y;
+    std::atomic<uint64_t> row_mask;
+    std::atomic<uint64_t> rows[kChunkSize];
+    // True while the chunk is linked into the pending list.
+    std::atomic<bool> pending;
+    Chunk* next_pending;
+  };
+
+  Chunk* GetChunk(int chunk_x, int chunk_y);
+
+  // Used only by writers.  Chunks are never removed, so the reader can keep
+  // pointers to them.
+  std::unordered_map<uint64_t, std::unique_ptr<Chunk>> chunks_;
+  uint64_t last_key_;
+  Chunk* last_chunk_;
+
+  std::atomic<Chunk*> pending_head_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_DIRTY_FIELD_SET_H_
@@ -0,0 +1,207 @@
+#include "draw_queue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace Grid {
+
+constexpr int DrawQueue::kBuckets;
+constexpr int DrawQueue::kChunkBits;
+constexpr int DrawQueue::kChunkSize;
+constexpr int DrawQueue::kChunkArea;
+
+static_assert(kAllLayers <= 0xff, "Layer masks don't fit in a byte.");
+
+DrawQueue::DrawQueue()
+    : chunks_(), last_key_(0), last_chunk_(nullptr), lowest_bucket_(kBuckets),
+      size_(0) {
+  std::fill_n(bucket_sizes_, kBuckets, 0);
+}
+
+void DrawQueue::Add(int x, int y, LayerMask layers, int bucket) {
+  assert(0 <= bucket and bucket < kBuckets);
+  assert(layers != 0);
+  Chunk* chunk = FindOrCreateChunk(x, y);
+  const int index = IndexInChunk(x, y);
+  if (chunk->layers[index] == 0) {
+    chunk->count++;
+    size_++;
+  } else if (chunk->bucket[index] <= bucket) {
+    // Its entry is going to be taken no later than a new one.
+    chunk->layers[index] |= layers;
+    return;
+  } else {
+    bucket_sizes_[chunk->bucket[index]]--;
+  }
+  bucket_sizes_[bucket]++;
+  chunk->layers[index] |= layers;
+  chunk->bucket[index] = bucket;
+  buckets_[bucket].push_back(
+      (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) |
+      static_cast<uint32_t>(y));
+  if (bucket < lowest_bucket_) {
+    lowest_bucket_ = bucket;
+  }
+}
+
+void DrawQueue::Erase(int x, int y) {
+  Chunk* chunk = FindChunk(x, y);
+  if (chunk == nullptr) {
+    return;
+  }
+  const int index = IndexInChunk(x, y);
+  if (chunk->layers[index] != 0) {
+    Remove(x, y, chunk, index);
+  }
+}
+
+bool DrawQueue::Pop(int& x, int& y, LayerMask& layers) {
+  while (size_ > 0) {
+    std::vector<uint64_t>& bucket = buckets_[lowest_bucket_];
+    if (bucket.empty()) {
+      lowest_bucket_++;
+      continue;
+    }
+    const uint64_t entry = bucket.back();
+    bucket.pop_back();
+    const int entry_x = static_cast<int32_t>(entry >> 32);
+    const int entry_y = static_cast<int32_t>(entry);
+    Chunk* chunk = FindChunk(entry_x, entry_y);
+    if (chunk == nullptr) {
+      continue;
+    }
+    const int index = IndexInChunk(entry_x, entry_y);
+    if (chunk->layers[index] == 0 or chunk->bucket[index] != lowest_bucket_) {
+      // Erased or moved to a lower bucket.
+      continue;
+    }
+    x = entry_x;
+    y = entry_y;
+    layers = chunk->layers[index];
+    Remove(entry_x, entry_y, chunk, index);
+    return true;
+  }
+  return false;
+}
+
+void DrawQueue::Clear() {
+  chunks_.clear();
+  last_chunk_ = nullptr;
+  for (int i = 0; i < kBuckets; i++) {
+    buckets_[i].clear();
+  }
+  std::fill_n(bucket_sizes_, kBuckets, 0);
+  lowest_bucket_ = kBuckets;
+  size_ = 0;
+}
+
+void DrawQueue::Rebucket(
+    const std::function<int(int, int, int)>& bucket_of) {
+  if (size_ == 0) {
+    return;
+  }
+  for (int i = 0; i < kBuckets; i++) {
+    buckets_[i].clear();
+  }
+  std::fill_n(bucket_sizes_, kBuckets, 0);
+  lowest_bucket_ = kBuckets;
+  for (auto& entry : chunks_) {
+    Chunk& chunk = *entry.second;
+    const int base_x = static_cast<int32_t>(entry.first >> 32) * kChunkSize;
+    const int base_y = static_cast<int32_t>(entry.first) * kChunkSize;
+    for (int index = 0; index < kChunkArea; index++) {
+      if (chunk.layers[index] == 0) {
+        continue;
+      }
+      const int x = base_x + (index & (kChunkSize - 1));
+      const int y = base_y + (index >> kChunkBits);
+      const int bucket = bucket_of(x, y, chunk.bucket[index]);
+      assert(0 <= bucket and bucket < kBuckets);
+      chunk.bucket[index] = bucket;
+      bucket_sizes_[bucket]++;
+      buckets_[bucket].push_back(
+          (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) |
+          static_cast<uint32_t>(y));
+      if (bucket < lowest_bucket_) {
+        lowest_bucket_ = bucket;
+      }
+    }
+  }
+}
+
+bool DrawQueue::empty() const {
+  return size_ == 0;
+}
+
+int64_t DrawQueue::size() const {
+  return size_;
+}
+
+bool DrawQueue::EmptyBelow(int bucket) const {
+  for (int i = lowest_bucket_; i < bucket; i++) {
+    if (bucket_sizes_[i] > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t DrawQueue::ChunkKey(int chunk_x, int chunk_y) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(chunk_x)) << 32) |
+      static_cast<uint32_t>(chunk_y);
+}
+
+int DrawQueue::IndexInChunk(int x, int y) {
+  return ((y & (kChunkSize - 1)) << kChunkBits) | (x & (kChunkSize - 1));
+}
+
+DrawQueue::Chunk* DrawQueue::FindChunk(int x, int y) {
+  const uint64_t key = ChunkKey(x >> kChunkBits, y >> kChunkBits);
+  if (last_chunk_ != nullptr and last_key_ == key) {
+    return last_chunk_;
+  }
+  auto it = chunks_.find(key);
+  if (it == chunks_.end()) {
+    return nullptr;
+  }
+  last_key_ = key;
+  last_chunk_ = it->second.get();
+  return last_chunk_;
+}
+
+DrawQueue::Chunk* DrawQueue::FindOrCreateChunk(int x, int y) {
+  Chunk* chunk = FindChunk(x, y);
+  if (chunk != nullptr) {
+    return chunk;
+  }
+  const uint64_t key = ChunkKey(x >> kChunkBits, y >> kChunkBits);
+  std::unique_ptr<Chunk>& entry = chunks_[key];
+  entry.reset(new Chunk);
+  std::memset(entry->layers, 0, sizeof(entry->layers));
+  entry->count = 0;
+  last_key_ = key;
+  last_chunk_ = entry.get();
+  return last_chunk_;
+}
+
+void DrawQueue::Remove(int x, int y, Chunk* chunk, int index) {
+  chunk->layers[index] = 0;
+  bucket_sizes_[chunk->bucket[index]]--;
+  size_--;
+  if (--chunk->count == 0) {
+    if (last_chunk_ == chunk) {
+      last_chunk_ = nullptr;
+    }
+    chunks_.erase(ChunkKey(x >> kChunkBits, y >> kChunkBits));
+  }
+  if (size_ == 0) {
+    // Only stale entries are left.
+    for (int i = 0; i < kBuckets; i++) {
+      buckets_[i].clear();
+    }
+    lowest_bucket_ = kBuckets;
+  }
+}
+
+}  // namespace Grid
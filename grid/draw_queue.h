@@ -0,0 +1,87 @@
+#ifndef GRID_DRAW_QUEUE_H_
+#define GRID_DRAW_QUEUE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "layer.h"
+
+namespace Grid {
+
+// Fields waiting to be drawn, with the layers to redraw.  Every field is in
+// one of @kBuckets buckets and fields are taken out of the lowest non-empty
+// bucket first; the order inside a bucket is unspecified.  Adding a field
+// that is already queued merges the layers and keeps the lower bucket.
+//
+// The state of the fields is kept in per-chunk arrays and the buckets are
+// plain vectors of coordinates, so adding and taking fields doesn't allocate
+// once the vectors have grown.  An entry made stale by @Erase() or by moving
+// its field to a lower bucket stays in its vector and is skipped when taken.
+//
+// Not thread-safe.
+class DrawQueue {
+ public:
+  static constexpr int kBuckets = 16;
+
+  DrawQueue();
+
+  DrawQueue(const DrawQueue&) = delete;
+  DrawQueue& operator=(const DrawQueue&) = delete;
+
+  // @bucket is in range [0, @kBuckets).  @layers mustn't be empty.
+  void Add(int x, int y, LayerMask layers, int bucket);
+  void Erase(int x, int y);
+  // Takes the field out.  Returns false when the queue is empty.
+  bool Pop(int& x, int& y, LayerMask& layers);
+  void Clear();
+  // Moves every queued field to bucket @bucket_of(x, y, bucket), where
+  // @bucket is its current one.  Goes over all queued fields.
+  void Rebucket(const std::function<int(int, int, int)>& bucket_of);
+
+  bool empty() const;
+  // Number of queued fields.
+  int64_t size() const;
+  // True when no field is queued in buckets [0, @bucket).
+  bool EmptyBelow(int bucket) const;
+
+ private:
+  static constexpr int kChunkBits = 6;
+  static constexpr int kChunkSize = 1 << kChunkBits;
+  static constexpr int kChunkArea = kChunkSize * kChunkSize;
+
+  struct Chunk {
+    // 0 when the field is not queued.
+    uint8_t layers[kChunkArea];
+    uint8_t bucket[kChunkArea];
+    // Number of queued fields.
+    int count;
+  };
+
+  static uint64_t ChunkKey(int chunk_x, int chunk_y);
+  static int IndexInChunk(int x, int y);
+  // Returns nullptr when the chunk has no queued fields.
+  Chunk* FindChunk(int x, int y);
+  Chunk* FindOrCreateChunk(int x, int y);
+  // Drops the field from its chunk, and the chunk when it becomes empty.
+  void Remove(int x, int y, Chunk* chunk, int index);
+
+  // Only chunks with queued fields are kept.
+  std::unordered_map<uint64_t, std::unique_ptr<Chunk>> chunks_;
+  uint64_t last_key_;
+  Chunk* last_chunk_;
+
+  // Coordinates of fields, x in the upper half.
+  std::vector<uint64_t> buckets_[kBuckets];
+  // Number of queued fields in every bucket.
+  int64_t bucket_sizes_[kBuckets];
+  // Buckets below are empty.
+  int lowest_bucket_;
+  int64_t size_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_DRAW_QUEUE_H_
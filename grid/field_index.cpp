@@ -0,0 +1,66 @@
+#include "field_index.h"
+
+namespace Grid {
+
+FieldIndex::FieldIndex() : buckets_(), positions_() {}
+
+void FieldIndex::Set(int x, int y, uint32_t key) {
+  auto inserted = positions_.emplace(FieldKey(x, y), std::make_pair(key, 0));
+  std::pair<uint32_t, uint32_t>& position = inserted.first->second;
+  if (!inserted.second) {
+    if (position.first == key) {
+      return;
+    }
+    Erase(x, y);
+    Set(x, y, key);
+    return;
+  }
+  std::vector<std::pair<int, int>>& bucket = buckets_[key];
+  position.second = bucket.size();
+  bucket.emplace_back(x, y);
+}
+
+void FieldIndex::Erase(int x, int y) {
+  auto it = positions_.find(FieldKey(x, y));
+  if (it == positions_.end()) {
+    return;
+  }
+  auto bucket = buckets_.find(it->second.first);
+  std::vector<std::pair<int, int>>& fields = bucket->second;
+  // The last field of the bucket takes the place of the removed one.
+  const std::pair<int, int> last = fields.back();
+  fields[it->second.second] = last;
+  positions_[FieldKey(last.first, last.second)].second = it->second.second;
+  fields.pop_back();
+  if (fields.empty()) {
+    buckets_.erase(bucket);
+  }
+  positions_.erase(it);
+}
+
+void FieldIndex::Clear() {
+  buckets_.clear();
+  positions_.clear();
+}
+
+const std::vector<std::pair<int, int>>& FieldIndex::Find(uint32_t key) const {
+  static const std::vector<std::pair<int, int>> empty;
+  auto it = buckets_.find(key);
+  return it == buckets_.end() ? empty : it->second;
+}
+
+std::vector<uint32_t> FieldIndex::Keys() const {
+  std::vector<uint32_t> keys;
+  keys.reserve(buckets_.size());
+  for (const auto& bucket : buckets_) {
+    keys.push_back(bucket.first);
+  }
+  return keys;
+}
+
+uint64_t FieldIndex::FieldKey(int x, int y) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) |
+         static_cast<uint32_t>(y);
+}
+
+}  // namespace Grid
@@ -0,0 +1,41 @@
+#ifndef GRID_FIELD_INDEX_H_
+#define GRID_FIELD_INDEX_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Grid {
+
+// A secondary index of fields: maps keys (e.g. object types) to the
+// coordinates of the fields that have them.  A field has at most one key.
+// Adding, moving and removing a field take constant time, and listing the
+// fields of a key takes time proportional to their number.  Not thread-safe.
+class FieldIndex {
+ public:
+  FieldIndex();
+
+  // Moves the field to @key, adding it when it is not indexed.
+  void Set(int x, int y, uint32_t key);
+  // Does nothing when the field is not indexed.
+  void Erase(int x, int y);
+  void Clear();
+
+  // In no particular order.
+  const std::vector<std::pair<int, int>>& Find(uint32_t key) const;
+  // Keys of at least one field, in no particular order.
+  std::vector<uint32_t> Keys() const;
+
+ private:
+  static uint64_t FieldKey(int x, int y);
+
+  // Fields of every key.  Empty buckets are removed.
+  std::unordered_map<uint32_t, std::vector<std::pair<int, int>>> buckets_;
+  // The key of every indexed field and its position in the bucket.
+  std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> positions_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_FIELD_INDEX_H_
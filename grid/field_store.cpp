@@ -0,0 +1,849 @@
+#include "field_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "chunk_pager.h"
+
+namespace Grid {
+
+constexpr int FieldStore::kChunkBits;
+constexpr int FieldStore::kChunkSize;
+constexpr int FieldStore::kChunkArea;
+constexpr int FieldStore::kMaxStyle;
+constexpr uint32_t FieldStore::kLabelTemplate;
+
+void FieldStore::FieldRef::set_last_update_time(int64_t time) const {
+  chunk_->last_update_time[index_] = time;
+  chunk_->max_update_time = std::max(chunk_->max_update_time, time);
+}
+
+void FieldStore::FieldRef::set_value(float value) const {
+  chunk_->value[index_] = value;
+  chunk_->has_value[index_ >> kChunkBits] |=
+      uint64_t(1) << (index_ & (kChunkSize - 1));
+}
+
+void FieldStore::FieldRef::clear_value() const {
+  chunk_->has_value[index_ >> kChunkBits] &=
+      ~(uint64_t(1) << (index_ & (kChunkSize - 1)));
+}
+
+FieldStore::Entry::Entry()
+    : chunk(), slot(), max_update_time(0), last_write(0),
+      hash(std::make_shared<std::atomic<uint64_t>>(0)) {}
+
+FieldStore::Entry::Entry(std::shared_ptr<Chunk> chunk)
+    : chunk(std::move(chunk)), slot(), max_update_time(0), last_write(0),
+      hash(std::make_shared<std::atomic<uint64_t>>(0)) {}
+
+FieldStore::Entry::Entry(const Entry& other)
+    : chunk(std::atomic_load(&other.chunk)), slot(other.slot),
+      max_update_time(other.max_update_time), last_write(other.last_write),
+      hash(other.hash), check(other.check) {}
+
+FieldStore::Entry& FieldStore::Entry::operator=(const Entry& other) {
+  chunk = std::atomic_load(&other.chunk);
+  slot = other.slot;
+  max_update_time = other.max_update_time;
+  last_write = other.last_write;
+  hash = other.hash;
+  check = other.check;
+  return *this;
+}
+
+FieldStore::Delta::Delta()
+    : changed_(), removed_(), size_(0), labels_(), styles_(),
+      write_clock_(0) {}
+
+FieldStore::FieldStore()
+    : chunks_(), size_(0), labels_(std::make_shared<LabelTable>()),
+      styles_(std::make_shared<
+          std::vector<std::shared_ptr<const Style>>>()),
+      resident_chunks_(0),
+      read_errors_(std::make_shared<std::atomic<int64_t>>(0)),
+      write_clock_(0), scratch_(), last_key_(0), last_entry_(nullptr) {}
+
+FieldStore::FieldStore(const FieldStore& other)
+    : chunks_(other.chunks_), size_(other.size_), labels_(other.labels_),
+      styles_(other.styles_), resident_chunks_(other.resident_chunks_.load()),
+      read_errors_(other.read_errors_), write_clock_(other.write_clock_),
+      scratch_(), last_key_(0), last_entry_(nullptr) {}
+
+FieldStore& FieldStore::operator=(const FieldStore& other) {
+  chunks_ = other.chunks_;
+  size_ = other.size_;
+  labels_ = other.labels_;
+  styles_ = other.styles_;
+  resident_chunks_ = other.resident_chunks_.load();
+  read_errors_ = other.read_errors_;
+  write_clock_ = other.write_clock_;
+  last_entry_ = nullptr;
+  return *this;
+}
+
+void FieldStore::Clear() {
+  chunks_.clear();
+  size_ = 0;
+  resident_chunks_ = 0;
+  // Copies of the store may still use the old table.
+  labels_ = std::make_shared<LabelTable>();
+  last_entry_ = nullptr;
+}
+
+FieldStore::FieldRef FieldStore::Find(int x, int y) {
+  Chunk* chunk = FindChunk(x, y);
+  if (chunk == nullptr) {
+    return FieldRef();
+  }
+  const int index = IndexInChunk(x, y);
+  if (!(chunk->occupancy[index >> kChunkBits] >> (index & (kChunkSize - 1)) &
+        1)) {
+    return FieldRef();
+  }
+  return FieldRef(chunk, index);
+}
+
+FieldStore::FieldView FieldStore::Find(int x, int y) const {
+  const Chunk* chunk = FindChunk(x, y);
+  if (chunk == nullptr) {
+    return FieldView();
+  }
+  const int index = IndexInChunk(x, y);
+  if (!(chunk->occupancy[index >> kChunkBits] >> (index & (kChunkSize - 1)) &
+        1)) {
+    return FieldView();
+  }
+  return FieldView(chunk, index);
+}
+
+FieldStore::FieldRef FieldStore::FindOrCreate(
+    int x, int y, int default_background, int default_object,
+    int64_t default_time, bool& created) {
+  Chunk* chunk = FindOrCreateChunk(x, y, default_time);
+  const int index = IndexInChunk(x, y);
+  uint64_t& row = chunk->occupancy[index >> kChunkBits];
+  const uint64_t bit = uint64_t(1) << (index & (kChunkSize - 1));
+  created = !(row & bit);
+  if (created) {
+    row |= bit;
+    chunk->background[index] = default_background;
+    chunk->object[index] = default_object;
+    chunk->last_update_time[index] = default_time;
+    chunk->max_update_time = std::max(chunk->max_update_time, default_time);
+    chunk->label[index] = 0;
+    chunk->style[index] = 0;
+    if (chunk != scratch_.get()) {
+      size_++;
+    }
+  }
+  return FieldRef(chunk, index);
+}
+
+int64_t FieldStore::ForEachRunInRegion(
+    int x0, int y0, int width, int height, int default_background,
+    int default_object, int64_t default_time,
+    const std::function<void(Chunk&, int, int, int, int)>& callback) {
+  if (width <= 0 or height <= 0) {
+    return 0;
+  }
+  const int x1 = x0 + width - 1;
+  const int y1 = y0 + height - 1;
+  int64_t created_fields = 0;
+  for (int chunk_y = ChunkCoordinate(y0); chunk_y <= ChunkCoordinate(y1);
+       chunk_y++) {
+    const int top = std::max(y0, chunk_y * kChunkSize);
+    const int bottom = std::min(y1, chunk_y * kChunkSize + kChunkSize - 1);
+    for (int chunk_x = ChunkCoordinate(x0); chunk_x <= ChunkCoordinate(x1);
+         chunk_x++) {
+      const int left = std::max(x0, chunk_x * kChunkSize);
+      const int right = std::min(x1, chunk_x * kChunkSize + kChunkSize - 1);
+      const int length = right - left + 1;
+      const int shift = left & (kChunkSize - 1);
+      const uint64_t mask =
+          (length == kChunkSize ? ~uint64_t(0)
+                                : (uint64_t(1) << length) - 1) << shift;
+      Chunk& chunk = *FindOrCreateChunk(left, top, default_time);
+      for (int y = top; y <= bottom; y++) {
+        const int index = IndexInChunk(left, y);
+        uint64_t& row = chunk.occupancy[index >> kChunkBits];
+        uint64_t created = mask & ~row;
+        if (created != 0) {
+          row |= created;
+          if (&chunk != scratch_.get()) {
+            created_fields += __builtin_popcountll(created);
+          }
+          const int row_start = index - shift;
+          while (created != 0) {
+            const int i = row_start + __builtin_ctzll(created);
+            created &= created - 1;
+            chunk.background[i] = default_background;
+            chunk.object[i] = default_object;
+            chunk.last_update_time[i] = default_time;
+            chunk.label[i] = 0;
+            chunk.style[i] = 0;
+          }
+          chunk.max_update_time =
+              std::max(chunk.max_update_time, default_time);
+        }
+        callback(chunk, index, length, left, y);
+      }
+    }
+  }
+  size_ += created_fields;
+  return created_fields;
+}
+
+void FieldStore::ForEachInRect(
+    int x0, int y0, int x1, int y1,
+    const std::function<void(int, int, FieldView)>& callback) const {
+  if (x1 < x0 or y1 < y0) {
+    return;
+  }
+  const int min_chunk_x = ChunkCoordinate(x0);
+  const int max_chunk_x = ChunkCoordinate(x1);
+  const int min_chunk_y = ChunkCoordinate(y0);
+  const int max_chunk_y = ChunkCoordinate(y1);
+  const uint64_t chunks_in_rect =
+      uint64_t(int64_t(max_chunk_x) - min_chunk_x + 1) *
+      uint64_t(int64_t(max_chunk_y) - min_chunk_y + 1);
+  if (chunks_in_rect <= chunks_.size()) {
+    for (int chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++) {
+      for (int chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++) {
+        auto it = chunks_.find(ChunkKey(chunk_x, chunk_y));
+        if (it != chunks_.end()) {
+          ForEachInChunkRect(chunk_x, chunk_y, *PeekChunk(it->second), x0, y0,
+                             x1, y1, callback);
+        }
+      }
+    }
+    return;
+  }
+  // The rectangle is larger than the board; goes over the existing chunks
+  // instead.
+  std::vector<std::pair<std::pair<int, int>, const Entry*>> chunks;
+  for (const auto& entry : chunks_) {
+    const int chunk_x = static_cast<int32_t>(entry.first >> 32);
+    const int chunk_y = static_cast<int32_t>(entry.first);
+    if (min_chunk_x <= chunk_x and chunk_x <= max_chunk_x and
+        min_chunk_y <= chunk_y and chunk_y <= max_chunk_y) {
+      chunks.emplace_back(std::make_pair(chunk_y, chunk_x), &entry.second);
+    }
+  }
+  std::sort(chunks.begin(), chunks.end());
+  for (const auto& chunk : chunks) {
+    ForEachInChunkRect(chunk.first.second, chunk.first.first,
+                       *PeekChunk(*chunk.second), x0, y0, x1, y1, callback);
+  }
+}
+
+uint32_t FieldStore::InternLabel(const std::string& label) {
+  const uint32_t id = labels_->Intern(label);
+  assert(id < kLabelTemplate);
+  return id;
+}
+
+const std::string& FieldStore::Label(uint32_t id) const {
+  return labels_->Get(id & ~kLabelTemplate);
+}
+
+const std::string& FieldStore::FieldLabel(uint32_t id, int x, int y,
+                                          std::string& expanded) const {
+  if ((id & kLabelTemplate) == 0) {
+    return Label(id);
+  }
+  expanded = ExpandLabel(Label(id), x, y);
+  return expanded;
+}
+
+void FieldStore::DefineStyle(int id, const Style& style) {
+  assert(0 < id and id <= kMaxStyle);
+  // Copies of the store keep the old table.
+  auto styles =
+      std::make_shared<std::vector<std::shared_ptr<const Style>>>(*styles_);
+  if (styles->size() <= static_cast<size_t>(id)) {
+    styles->resize(id + 1);
+  }
+  (*styles)[id] = std::make_shared<const Style>(style);
+  styles_ = std::move(styles);
+}
+
+const FieldStore::Style* FieldStore::FindStyle(int id) const {
+  if (id <= 0 or static_cast<size_t>(id) >= styles_->size()) {
+    return nullptr;
+  }
+  return (*styles_)[id].get();
+}
+
+int FieldStore::StyleTableSize() const {
+  return static_cast<int>(styles_->size());
+}
+
+void FieldStore::DetachStyle(const FieldRef& field, int x, int y) {
+  if (field.style() == 0) {
+    return;
+  }
+  const Style* style = FindStyle(field.style());
+  if (style != nullptr) {
+    field.background() = style->background;
+    field.object() = style->object;
+    const uint32_t label = InternLabel(style->label);
+    field.label() = style->label.find('{') == std::string::npos
+                        ? label
+                        : label | kLabelTemplate;
+  }
+  field.style() = 0;
+}
+
+std::string FieldStore::ExpandLabel(const std::string& label, int x, int y) {
+  std::string expanded;
+  size_t start = 0;
+  size_t brace;
+  while ((brace = label.find('{', start)) != std::string::npos) {
+    expanded.append(label, start, brace - start);
+    if (label.compare(brace, 3, "{x}") == 0) {
+      expanded += std::to_string(x);
+      start = brace + 3;
+    } else if (label.compare(brace, 3, "{y}") == 0) {
+      expanded += std::to_string(y);
+      start = brace + 3;
+    } else {
+      expanded += '{';
+      start = brace + 1;
+    }
+  }
+  expanded.append(label, start, std::string::npos);
+  return expanded;
+}
+
+void FieldStore::ForEachChunk(
+    const std::function<void(int, int, const Chunk&, int)>& callback) const {
+  for (const auto& entry : chunks_) {
+    const std::shared_ptr<Chunk> chunk = PeekChunk(entry.second);
+    callback(static_cast<int32_t>(entry.first >> 32),
+             static_cast<int32_t>(entry.first),
+             *chunk,
+             CountFields(*chunk));
+  }
+}
+
+bool FieldStore::AddChunk(int chunk_x, int chunk_y,
+                          std::shared_ptr<Chunk> chunk, int number_of_fields,
+                          std::shared_ptr<const ChunkValidator> validator) {
+  Entry entry(std::move(chunk));
+  entry.last_write = ++write_clock_;
+  if (validator != nullptr) {
+    entry.check = std::make_shared<PendingCheck>();
+    entry.check->validator = std::move(validator);
+    entry.check->number_of_fields = number_of_fields;
+    entry.check->valid = false;
+  }
+  if (!chunks_.emplace(ChunkKey(chunk_x, chunk_y), std::move(entry)).second) {
+    return false;
+  }
+  size_ += number_of_fields;
+  resident_chunks_++;
+  return true;
+}
+
+const LabelTable& FieldStore::labels() const {
+  return *labels_;
+}
+
+bool FieldStore::PageOut(ChunkPager& pager, int64_t max_resident,
+                         const std::function<bool(int, int)>& keep) {
+  if (resident_chunks_ <= max_resident) {
+    return true;
+  }
+  std::vector<std::pair<uint64_t, Entry*>> candidates;
+  for (auto& entry : chunks_) {
+    if (entry.second.chunk != nullptr and
+        !keep(static_cast<int32_t>(entry.first >> 32),
+              static_cast<int32_t>(entry.first))) {
+      candidates.emplace_back(entry.second.last_write, &entry.second);
+    }
+  }
+  const size_t count = std::min<size_t>(candidates.size(),
+                                        resident_chunks_ - max_resident);
+  std::partial_sort(candidates.begin(), candidates.begin() + count,
+                    candidates.end(),
+                    [](const std::pair<uint64_t, Entry*>& a,
+                       const std::pair<uint64_t, Entry*>& b) -> bool {
+                      return a.first < b.first;
+                    });
+  for (size_t i = 0; i < count; i++) {
+    Entry& entry = *candidates[i].second;
+    if (entry.slot == nullptr) {
+      entry.slot = pager.Write(*entry.chunk);
+      if (entry.slot == nullptr) {
+        return false;
+      }
+    }
+    entry.max_update_time = entry.chunk->max_update_time;
+    // Copies of the store keep their reference to the chunk.
+    entry.chunk.reset();
+    resident_chunks_--;
+  }
+  return true;
+}
+
+void FieldStore::PageIn(int chunk_x0, int chunk_y0, int chunk_x1,
+                        int chunk_y1) {
+  const uint64_t chunks_in_rect =
+      uint64_t(int64_t(chunk_x1) - chunk_x0 + 1) *
+      uint64_t(int64_t(chunk_y1) - chunk_y0 + 1);
+  if (chunks_in_rect <= chunks_.size()) {
+    for (int chunk_y = chunk_y0; chunk_y <= chunk_y1; chunk_y++) {
+      for (int chunk_x = chunk_x0; chunk_x <= chunk_x1; chunk_x++) {
+        auto it = chunks_.find(ChunkKey(chunk_x, chunk_y));
+        if (it != chunks_.end()) {
+          LoadChunk(it->second);
+        }
+      }
+    }
+    return;
+  }
+  for (const auto& entry : chunks_) {
+    const int chunk_x = static_cast<int32_t>(entry.first >> 32);
+    const int chunk_y = static_cast<int32_t>(entry.first);
+    if (chunk_x0 <= chunk_x and chunk_x <= chunk_x1 and
+        chunk_y0 <= chunk_y and chunk_y <= chunk_y1) {
+      LoadChunk(entry.second);
+    }
+  }
+}
+
+int64_t FieldStore::ResidentChunks() const {
+  return resident_chunks_;
+}
+
+int64_t FieldStore::ReadErrors() const {
+  return read_errors_->load();
+}
+
+void FieldStore::ForEachFieldUpdatedAt(
+    int64_t time, const std::function<void(int, int)>& callback) const {
+  for (const auto& entry : chunks_) {
+    std::shared_ptr<Chunk> loaded = std::atomic_load(&entry.second.chunk);
+    if (loaded == nullptr) {
+      if (entry.second.max_update_time < time) {
+        continue;
+      }
+      loaded = ReadChunk(entry.second);
+      if (loaded == nullptr) {
+        continue;
+      }
+    }
+    const Chunk& chunk = *CheckedChunk(entry.second, std::move(loaded));
+    if (chunk.max_update_time < time) {
+      continue;
+    }
+    const int base_x = static_cast<int32_t>(entry.first >> 32) * kChunkSize;
+    const int base_y = static_cast<int32_t>(entry.first) * kChunkSize;
+    for (int dy = 0; dy < kChunkSize; dy++) {
+      uint64_t row = chunk.occupancy[dy];
+      while (row != 0) {
+        const int dx = __builtin_ctzll(row);
+        row &= row - 1;
+        if (chunk.last_update_time[(dy << kChunkBits) | dx] == time) {
+          callback(base_x + dx, base_y + dy);
+        }
+      }
+    }
+  }
+}
+
+void FieldStore::ForEachDifferentChunk(
+    const FieldStore& other,
+    const std::function<void(int, int)>& callback) const {
+  for (const auto& entry : chunks_) {
+    auto it = other.chunks_.find(entry.first);
+    if (it == other.chunks_.end() or !SameChunk(entry.second, it->second)) {
+      callback(static_cast<int32_t>(entry.first >> 32),
+               static_cast<int32_t>(entry.first));
+    }
+  }
+  for (const auto& entry : other.chunks_) {
+    if (chunks_.find(entry.first) == chunks_.end()) {
+      callback(static_cast<int32_t>(entry.first >> 32),
+               static_cast<int32_t>(entry.first));
+    }
+  }
+}
+
+FieldStore::Delta FieldStore::DiffFrom(const FieldStore& base) const {
+  Delta delta;
+  for (const auto& entry : chunks_) {
+    auto it = base.chunks_.find(entry.first);
+    if (it == base.chunks_.end() or !SameChunk(entry.second, it->second)) {
+      delta.changed_.emplace_back(entry.first, entry.second);
+    }
+  }
+  for (const auto& entry : base.chunks_) {
+    if (chunks_.find(entry.first) == chunks_.end()) {
+      delta.removed_.push_back(entry.first);
+    }
+  }
+  delta.size_ = size_;
+  delta.labels_ = labels_;
+  delta.styles_ = styles_;
+  delta.write_clock_ = write_clock_;
+  return delta;
+}
+
+void FieldStore::Patch(const Delta& delta) {
+  for (uint64_t key : delta.removed_) {
+    auto it = chunks_.find(key);
+    if (it != chunks_.end()) {
+      if (it->second.chunk != nullptr) {
+        resident_chunks_--;
+      }
+      chunks_.erase(it);
+    }
+  }
+  for (const auto& entry : delta.changed_) {
+    Entry& patched = chunks_[entry.first];
+    if (patched.chunk != nullptr) {
+      resident_chunks_--;
+    }
+    patched = entry.second;
+    if (patched.chunk != nullptr) {
+      resident_chunks_++;
+    }
+  }
+  size_ = delta.size_;
+  labels_ = delta.labels_;
+  styles_ = delta.styles_;
+  write_clock_ = std::max(write_clock_, delta.write_clock_);
+  last_entry_ = nullptr;
+}
+
+void FieldStore::ForEachDifference(
+    const FieldStore& other,
+    const std::function<void(int, int)>& callback) const {
+  for (const auto& entry : chunks_) {
+    const int chunk_x = static_cast<int32_t>(entry.first >> 32);
+    const int chunk_y = static_cast<int32_t>(entry.first);
+    const int base_x = chunk_x * kChunkSize;
+    const int base_y = chunk_y * kChunkSize;
+    auto it = other.chunks_.find(entry.first);
+    if (it == other.chunks_.end()) {
+      ForEachInChunkRect(chunk_x, chunk_y, *PeekChunk(entry.second), base_x,
+                         base_y, base_x + kChunkSize - 1,
+                         base_y + kChunkSize - 1,
+                         [&callback](int x, int y, FieldView) -> void {
+                           callback(x, y);
+                         });
+      continue;
+    }
+    if (SameChunk(entry.second, it->second) or
+        ChunkHash(entry.second) == other.ChunkHash(it->second)) {
+      continue;
+    }
+    const std::shared_ptr<Chunk> chunk = PeekChunk(entry.second);
+    const std::shared_ptr<Chunk> other_chunk = PeekChunk(it->second);
+    for (int dy = 0; dy < kChunkSize; dy++) {
+      uint64_t row = chunk->occupancy[dy] | other_chunk->occupancy[dy];
+      while (row != 0) {
+        const int dx = __builtin_ctzll(row);
+        row &= row - 1;
+        if (!SameField(*chunk, other, *other_chunk, (dy << kChunkBits) | dx)) {
+          callback(base_x + dx, base_y + dy);
+        }
+      }
+    }
+  }
+  for (const auto& entry : other.chunks_) {
+    if (chunks_.find(entry.first) != chunks_.end()) {
+      continue;
+    }
+    const int chunk_x = static_cast<int32_t>(entry.first >> 32);
+    const int chunk_y = static_cast<int32_t>(entry.first);
+    ForEachInChunkRect(chunk_x, chunk_y, *PeekChunk(entry.second),
+                       chunk_x * kChunkSize, chunk_y * kChunkSize,
+                       chunk_x * kChunkSize + kChunkSize - 1,
+                       chunk_y * kChunkSize + kChunkSize - 1,
+                       [&callback](int x, int y, FieldView) -> void {
+                         callback(x, y);
+                       });
+  }
+}
+
+bool FieldStore::Empty() const {
+  return size_ == 0;
+}
+
+int64_t FieldStore::Size() const {
+  return size_;
+}
+
+int FieldStore::ChunkCoordinate(int coordinate) {
+  // Arithmetic shift rounds towards minus infinity.
+  return coordinate >> kChunkBits;
+}
+
+int FieldStore::IndexInChunk(int x, int y) {
+  return ((y & (kChunkSize - 1)) << kChunkBits) | (x & (kChunkSize - 1));
+}
+
+int FieldStore::CountFields(const Chunk& chunk) {
+  int count = 0;
+  for (int i = 0; i < kChunkSize; i++) {
+    count += __builtin_popcountll(chunk.occupancy[i]);
+  }
+  return count;
+}
+
+bool FieldStore::SameChunk(const Entry& a, const Entry& b) {
+  const std::shared_ptr<Chunk> a_chunk = std::atomic_load(&a.chunk);
+  if (a_chunk != nullptr and a_chunk == std::atomic_load(&b.chunk)) {
+    return true;
+  }
+  return a.slot != nullptr and a.slot == b.slot;
+}
+
+uint64_t FieldStore::ChunkHash(const Entry& entry) const {
+  uint64_t hash = entry.hash->load();
+  if (hash != 0) {
+    return hash;
+  }
+  const std::shared_ptr<Chunk> chunk = PeekChunk(entry);
+  const auto mix = [&hash](uint64_t part) -> void {
+    hash = (hash ^ part) * 0x9e3779b97f4a7c15;
+    hash ^= hash >> 29;
+  };
+  const std::hash<std::string> label_hash;
+  for (int dy = 0; dy < kChunkSize; dy++) {
+    uint64_t row = chunk->occupancy[dy];
+    mix(row);
+    while (row != 0) {
+      const int index = (dy << kChunkBits) | __builtin_ctzll(row);
+      row &= row - 1;
+      const FieldView field(chunk.get(), index);
+      uint32_t value_bits = 0;
+      if (field.has_value()) {
+        const float value = field.value();
+        std::memcpy(&value_bits, &value, sizeof(value_bits));
+      }
+      mix(static_cast<uint32_t>(field.background()));
+      mix(static_cast<uint32_t>(field.object()));
+      mix(field.style());
+      mix(field.has_value());
+      mix(value_bits);
+      // Label ids depend on the table of the store; their text doesn't.
+      // Id 0 is the empty label in every table.
+      mix(field.label() == 0 ? 0 : label_hash(Label(field.label())));
+      mix(field.label() & kLabelTemplate);
+    }
+  }
+  // 0 stands for a hash not computed yet.
+  hash += (hash == 0);
+  if (chunk != EmptyChunk()) {
+    entry.hash->store(hash);
+  }
+  return hash;
+}
+
+bool FieldStore::SameField(const Chunk& chunk, const FieldStore& other,
+                           const Chunk& other_chunk, int index) const {
+  const FieldView field(&chunk, index);
+  const FieldView other_field(&other_chunk, index);
+  const int row = index >> kChunkBits;
+  const uint64_t bit = uint64_t(1) << (index & (kChunkSize - 1));
+  if ((chunk.occupancy[row] & bit) != (other_chunk.occupancy[row] & bit)) {
+    return false;
+  }
+  return field.background() == other_field.background() and
+         field.object() == other_field.object() and
+         field.style() == other_field.style() and
+         field.has_value() == other_field.has_value() and
+         (!field.has_value() or field.value() == other_field.value()) and
+         (field.label() & kLabelTemplate) ==
+             (other_field.label() & kLabelTemplate) and
+         Label(field.label()) == other.Label(other_field.label());
+}
+
+uint64_t FieldStore::ChunkKey(int chunk_x, int chunk_y) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(chunk_x)) << 32) |
+         static_cast<uint32_t>(chunk_y);
+}
+
+std::shared_ptr<FieldStore::Chunk> FieldStore::ReadChunk(
+    const Entry& entry) const {
+  std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+  if (!entry.slot->Read(*chunk)) {
+    read_errors_->fetch_add(1);
+    return nullptr;
+  }
+  return chunk;
+}
+
+std::shared_ptr<FieldStore::Chunk> FieldStore::PeekChunk(
+    const Entry& entry) const {
+  std::shared_ptr<Chunk> chunk = std::atomic_load(&entry.chunk);
+  if (chunk == nullptr) {
+    chunk = ReadChunk(entry);
+    if (chunk == nullptr) {
+      return EmptyChunk();
+    }
+  }
+  return CheckedChunk(entry, std::move(chunk));
+}
+
+const std::shared_ptr<FieldStore::Chunk>& FieldStore::EmptyChunk() {
+  static const std::shared_ptr<Chunk> empty = []() -> std::shared_ptr<Chunk> {
+    std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+    std::fill_n(chunk->occupancy, kChunkSize, 0);
+    std::fill_n(chunk->has_value, kChunkSize, 0);
+    chunk->max_update_time = 0;
+    return chunk;
+  }();
+  return empty;
+}
+
+std::shared_ptr<FieldStore::Chunk> FieldStore::CheckedChunk(
+    const Entry& entry, std::shared_ptr<Chunk> chunk) {
+  if (entry.check == nullptr) {
+    return chunk;
+  }
+  PendingCheck& check = *entry.check;
+  std::call_once(check.once, [&check, &chunk]() {
+    check.valid = (*check.validator)(*chunk, check.number_of_fields);
+  });
+  return check.valid ? chunk : EmptyChunk();
+}
+
+void FieldStore::ForEachInChunkRect(
+    int chunk_x, int chunk_y, const Chunk& chunk, int x0, int y0, int x1,
+    int y1, const std::function<void(int, int, FieldView)>& callback) {
+  const int base_x = chunk_x * kChunkSize;
+  const int base_y = chunk_y * kChunkSize;
+  const int left = std::max(x0, base_x) - base_x;
+  const int right = std::min(x1, base_x + kChunkSize - 1) - base_x;
+  const int top = std::max(y0, base_y) - base_y;
+  const int bottom = std::min(y1, base_y + kChunkSize - 1) - base_y;
+  const int length = right - left + 1;
+  const uint64_t mask =
+      (length == kChunkSize ? ~uint64_t(0)
+                            : (uint64_t(1) << length) - 1) << left;
+  for (int dy = top; dy <= bottom; dy++) {
+    uint64_t row = chunk.occupancy[dy] & mask;
+    while (row != 0) {
+      const int dx = __builtin_ctzll(row);
+      row &= row - 1;
+      callback(base_x + dx, base_y + dy,
+               FieldView(&chunk, (dy << kChunkBits) | dx));
+    }
+  }
+}
+
+std::shared_ptr<FieldStore::Chunk> FieldStore::LoadChunk(
+    const Entry& entry) const {
+  std::shared_ptr<Chunk> chunk = std::atomic_load(&entry.chunk);
+  if (chunk == nullptr) {
+    std::shared_ptr<Chunk> expected;
+    chunk = ReadChunk(entry);
+    if (chunk == nullptr) {
+      // Tried again on the next access.
+      return EmptyChunk();
+    }
+    if (std::atomic_compare_exchange_strong(&entry.chunk, &expected, chunk)) {
+      resident_chunks_++;
+    } else {
+      // Another thread read it back first; pointers to its copy may be in
+      // use already.
+      chunk = expected;
+    }
+  }
+  return CheckedChunk(entry, std::move(chunk));
+}
+
+FieldStore::Chunk* FieldStore::FindChunk(int x, int y) {
+  const uint64_t key = ChunkKey(ChunkCoordinate(x), ChunkCoordinate(y));
+  if (last_entry_ == nullptr or last_key_ != key) {
+    auto it = chunks_.find(key);
+    if (it == chunks_.end()) {
+      return nullptr;
+    }
+    last_key_ = key;
+    last_entry_ = &it->second;
+  }
+  Entry& entry = *last_entry_;
+  if (entry.chunk == nullptr) {
+    std::shared_ptr<Chunk> chunk = ReadChunk(entry);
+    if (chunk == nullptr) {
+      // The chunk stays paged out and is read again on the next access.  The
+      // caller modifies an empty scratch chunk instead, so the change is
+      // dropped but the fields in the spill file are kept.
+      if (scratch_ == nullptr) {
+        scratch_.reset(new Chunk);
+      }
+      *scratch_ = *EmptyChunk();
+      return scratch_.get();
+    }
+    entry.chunk = std::move(chunk);
+    resident_chunks_++;
+  }
+  if (entry.check != nullptr) {
+    if (CheckedChunk(entry, entry.chunk) != entry.chunk) {
+      // The fields of an invalid chunk are dropped for good.
+      size_ -= entry.check->number_of_fields;
+      entry.chunk = EmptyChunk();
+    }
+    entry.check.reset();
+  }
+  if (entry.chunk.use_count() > 1) {
+    // Copy on write.
+    entry.chunk = std::make_shared<Chunk>(*entry.chunk);
+  } else {
+    // @use_count() is a relaxed load.  Copies drop their references with a
+    // release decrement, so the fence orders the writes of the caller after
+    // the last reads of the copies, e.g. of a snapshot released by the
+    // painter.
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  // The caller may modify the chunk.
+  entry.slot.reset();
+  entry.last_write = ++write_clock_;
+  if (entry.hash.use_count() > 1) {
+    // Copies keep the hash of their version.
+    entry.hash = std::make_shared<std::atomic<uint64_t>>(0);
+  } else {
+    entry.hash->store(0);
+  }
+  return entry.chunk.get();
+}
+
+FieldStore::Chunk* FieldStore::FindOrCreateChunk(int x, int y,
+                                                 int64_t default_time) {
+  Chunk* chunk = FindChunk(x, y);
+  if (chunk == nullptr) {
+    const uint64_t key = ChunkKey(ChunkCoordinate(x), ChunkCoordinate(y));
+    std::shared_ptr<Chunk> new_chunk = std::make_shared<Chunk>();
+    std::fill_n(new_chunk->occupancy, kChunkSize, 0);
+    std::fill_n(new_chunk->has_value, kChunkSize, 0);
+    new_chunk->max_update_time = default_time;
+    chunk = new_chunk.get();
+    Entry entry(std::move(new_chunk));
+    entry.last_write = ++write_clock_;
+    last_key_ = key;
+    last_entry_ = &chunks_.emplace(key, std::move(entry)).first->second;
+    resident_chunks_++;
+  }
+  return chunk;
+}
+
+const FieldStore::Chunk* FieldStore::FindChunk(int x, int y) const {
+  auto it = chunks_.find(ChunkKey(ChunkCoordinate(x), ChunkCoordinate(y)));
+  if (it == chunks_.end()) {
+    return nullptr;
+  }
+  // The store keeps the chunk alive.
+  return LoadChunk(it->second).get();
+}
+
+}  // namespace Grid
@@ -0,0 +1,394 @@
+#ifndef GRID_FIELD_STORE_H_
+#define GRID_FIELD_STORE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "label_table.h"
+
+namespace Grid {
+
+class ChunkPager;
+class ChunkSlot;
+
+// Dense storage of fields.  The board is split into square chunks of
+// @kChunkSize x @kChunkSize fields, which are kept in a hash map indexed with
+// chunk coordinates.  Inside a chunk, every property of a field has its own
+// array (column), so a lookup is a single hash probe followed by an index.
+//
+// Copying a store is cheap: chunks are shared between the copies and a chunk
+// is copied only when one of the stores modifies it.  A store is not
+// thread-safe, but different copies can be used by different threads.
+//
+// Chunks can be paged out to a ChunkPager (see @PageOut()) and are read back
+// transparently on the next access.  A chunk that can't be read back stays
+// paged out and is seen as empty until a later read succeeds; the error is
+// counted (see @ReadErrors()).
+class FieldStore {
+ public:
+  static constexpr int kChunkBits = 6;
+  static constexpr int kChunkSize = 1 << kChunkBits;
+  static constexpr int kChunkArea = kChunkSize * kChunkSize;
+
+  // Largest id of a style.
+  static constexpr int kMaxStyle = (1 << 16) - 1;
+
+  // The look of many fields at once.
+  struct Style {
+    int background;
+    int object;
+    // "{x}" and "{y}" stand for the coordinates of the field.
+    std::string label;
+  };
+
+  struct Chunk {
+    int background[kChunkArea];
+    int object[kChunkArea];
+    int64_t last_update_time[kChunkArea];
+    // Ids in the label table of the store.
+    uint32_t label[kChunkArea];
+    // Id of the style of the field (see @DefineStyle()), which then replaces
+    // the background, the object and the label above; 0 for none.
+    uint16_t style[kChunkArea];
+    // Scalar values, meaningful only when the bit of the field in @has_value
+    // (laid out like @occupancy) is set.
+    float value[kChunkArea];
+    uint64_t has_value[kChunkSize];
+    // The maximum of @last_update_time over the existing fields.
+    int64_t max_update_time;
+    // Bit (x % kChunkSize) of @occupancy[y % kChunkSize] is set when the field
+    // exists.
+    uint64_t occupancy[kChunkSize];
+  };
+
+  // A read-only reference to a single field.  Converts to false when the
+  // field doesn't exist.
+  class FieldView {
+   public:
+    FieldView() : chunk_(nullptr), index_(0) {}
+    FieldView(const Chunk* chunk, int index) : chunk_(chunk), index_(index) {}
+
+    explicit operator bool() const { return chunk_ != nullptr; }
+
+    int background() const { return chunk_->background[index_]; }
+    int object() const { return chunk_->object[index_]; }
+    int64_t last_update_time() const {
+      return chunk_->last_update_time[index_];
+    }
+    uint32_t label() const { return chunk_->label[index_]; }
+    uint16_t style() const { return chunk_->style[index_]; }
+    bool has_value() const {
+      return chunk_->has_value[index_ >> kChunkBits] >>
+          (index_ & (kChunkSize - 1)) & 1;
+    }
+    float value() const { return chunk_->value[index_]; }
+
+   private:
+    const Chunk* chunk_;
+    int index_;
+  };
+
+  // A reference to a single field: a chunk and an index in its columns.
+  // Converts to false when the field doesn't exist.
+  class FieldRef {
+   public:
+    FieldRef() : chunk_(nullptr), index_(0) {}
+    FieldRef(Chunk* chunk, int index) : chunk_(chunk), index_(index) {}
+
+    explicit operator bool() const { return chunk_ != nullptr; }
+
+    int& background() const { return chunk_->background[index_]; }
+    int& object() const { return chunk_->object[index_]; }
+    int64_t last_update_time() const {
+      return chunk_->last_update_time[index_];
+    }
+    void set_last_update_time(int64_t time) const;
+    uint32_t& label() const { return chunk_->label[index_]; }
+    uint16_t& style() const { return chunk_->style[index_]; }
+    bool has_value() const {
+      return chunk_->has_value[index_ >> kChunkBits] >>
+          (index_ & (kChunkSize - 1)) & 1;
+    }
+    float value() const { return chunk_->value[index_]; }
+    void set_value(float value) const;
+    void clear_value() const;
+
+    FieldView view() const { return FieldView(chunk_, index_); }
+
+   private:
+    Chunk* chunk_;
+    int index_;
+  };
+
+  FieldStore();
+  FieldStore(const FieldStore& other);
+  FieldStore& operator=(const FieldStore& other);
+
+  void Clear();
+
+  // Returns a null reference when the field doesn't exist.
+  FieldRef Find(int x, int y);
+  FieldView Find(int x, int y) const;
+
+  // Creates the field when it doesn't exist.  The new field has its columns
+  // filled with @default_background, @default_object and @default_time.
+  // Sets @created to true in that case.
+  FieldRef FindOrCreate(int x, int y, int default_background,
+                        int default_object, int64_t default_time,
+                        bool& created);
+
+  // Bulk version of @FindOrCreate() for the rectangle
+  // [x0, x0 + width) x [y0, y0 + height).  Creates the missing fields and
+  // calls @callback(chunk, index, length, x, y) for every horizontal run of
+  // fields inside one chunk: fields (x, y) ... (x + length - 1, y), at indices
+  // index ... index + length - 1 of the columns of the chunk, which the
+  // callback may write directly.  Returns the number of created fields.
+  int64_t ForEachRunInRegion(
+      int x0, int y0, int width, int height, int default_background,
+      int default_object, int64_t default_time,
+      const std::function<void(Chunk&, int, int, int, int)>& callback);
+
+  // Calls @callback(x, y, field) for every existing field in the rectangle
+  // [x0, x1] x [y0, y1]: chunk by chunk (rows of chunks from the top, left to
+  // right inside a row), and row by row inside a chunk.  Chunks that don't
+  // exist are skipped without looking at their fields.
+  void ForEachInRect(
+      int x0, int y0, int x1, int y1,
+      const std::function<void(int, int, FieldView)>& callback) const;
+
+  // Labels are interned in a table shared by all copies of the store.  A new
+  // field has the empty label, 0.  Clearing the store starts a new table.
+  // A label id with @kLabelTemplate set refers to a label with "{x}" and
+  // "{y}" in it, which stand for the coordinates of the field (see
+  // @FieldLabel()).
+  static constexpr uint32_t kLabelTemplate = uint32_t(1) << 31;
+  uint32_t InternLabel(const std::string& label);
+  // Templates are returned as they are.
+  const std::string& Label(uint32_t id) const;
+  // The text of label @id of the field at (@x, @y).  Templates are expanded
+  // into @expanded.
+  const std::string& FieldLabel(uint32_t id, int x, int y,
+                                std::string& expanded) const;
+
+  // Styles are kept in a table shared by the copies of the store until one of
+  // them defines a style.  Ids are in range [1, @kMaxStyle].  Clearing the
+  // store keeps the styles.
+  void DefineStyle(int id, const Style& style);
+  // Returns nullptr when the style is not defined.
+  const Style* FindStyle(int id) const;
+  // Styles are defined only for ids smaller than that.
+  int StyleTableSize() const;
+  // Copies the look of the style of @field at (@x, @y) to its columns and
+  // drops the style.  Fields of undefined styles keep their columns.  The
+  // label is kept as a template, so detaching many fields doesn't add a
+  // label per field.
+  void DetachStyle(const FieldRef& field, int x, int y);
+  // Replaces "{x}" and "{y}" in the label of a style or in a template.
+  static std::string ExpandLabel(const std::string& label, int x, int y);
+
+  // Calls @callback(chunk_x, chunk_y, chunk, number_of_fields) for every
+  // chunk.  Fields of a chunk have coordinates
+  // [chunk_x * kChunkSize, (chunk_x + 1) * kChunkSize) x
+  // [chunk_y * kChunkSize, (chunk_y + 1) * kChunkSize).
+  void ForEachChunk(
+      const std::function<void(int, int, const Chunk&, int)>& callback) const;
+
+  // Tells whether a chunk said to hold the given number of fields is valid.
+  using ChunkValidator = std::function<bool(const Chunk&, int)>;
+
+  // Adds a whole chunk.  The chunk can be shared with others, e.g. it can be
+  // a part of a memory-mapped file; it will be copied before the first
+  // modification.  Returns false, without adding anything, when the chunk
+  // already exists.  When @validator is given, the chunk is checked on its
+  // first use instead of here, and is seen as empty if it is invalid.  The
+  // fields of an invalid chunk are counted by @Size() until it is modified.
+  bool AddChunk(int chunk_x, int chunk_y, std::shared_ptr<Chunk> chunk,
+                int number_of_fields,
+                std::shared_ptr<const ChunkValidator> validator = nullptr);
+
+  const LabelTable& labels() const;
+
+  // Writes chunks to @pager and drops them from memory, least recently
+  // modified first, until at most @max_resident chunks stay in memory.
+  // Chunks for which @keep(chunk_x, chunk_y) returns true are never paged
+  // out.  Chunks not modified since they were last read back are not written
+  // again.  Returns false on I/O errors.
+  bool PageOut(ChunkPager& pager, int64_t max_resident,
+               const std::function<bool(int, int)>& keep);
+
+  // Reads the paged out chunks in
+  // [chunk_x0, chunk_x1] x [chunk_y0, chunk_y1] back into memory, so that
+  // copies made later share them.
+  void PageIn(int chunk_x0, int chunk_y0, int chunk_x1, int chunk_y1);
+
+  // Number of chunks in memory, including the ones shared with copies.
+  int64_t ResidentChunks() const;
+
+  // Number of failed reads of paged out chunks, by this store and its copies
+  // together.  A chunk that can't be read back is seen as empty, changes to
+  // its fields are dropped, and it is read again on the next access; its
+  // fields in the spill file are kept.
+  int64_t ReadErrors() const;
+
+  // Calls @callback(x, y) for every field whose last update time is @time.
+  // Chunks not updated since @time are skipped without looking at their
+  // fields.
+  void ForEachFieldUpdatedAt(
+      int64_t time, const std::function<void(int, int)>& callback) const;
+
+  // Calls @callback(chunk_x, chunk_y) for every chunk that may differ
+  // between this store and @other: chunks that exist in only one of them and
+  // chunks that are not shared.  Copies of a store share the chunks neither
+  // of them modified, so this goes over the chunks without looking at their
+  // fields.
+  void ForEachDifferentChunk(
+      const FieldStore& other,
+      const std::function<void(int, int)>& callback) const;
+
+  // The chunks in which a store differs from another one, its base (see
+  // @DiffFrom()).  Shares the chunks with the store, so it takes memory
+  // only for the chunks that differ.
+  class Delta;
+
+  // Returns the chunks that may differ between this store and @base, as
+  // found by @ForEachDifferentChunk().  @Patch() on a copy of @base then
+  // makes it hold the fields of this store.
+  Delta DiffFrom(const FieldStore& base) const;
+  void Patch(const Delta& delta);
+
+  // Calls @callback(x, y) for every field that exists in only one of the
+  // stores or differs in color, value, object, text or style (compared by
+  // id).  Update times are not compared.  Chunks are compared by their
+  // hashes first and only the chunks whose hashes differ are compared field
+  // by field.  The hash of a chunk is computed on the first comparison after
+  // the chunk changed and is shared by the copies of the store, so the
+  // stores can be unrelated, e.g. loaded from two files.
+  void ForEachDifference(const FieldStore& other,
+                         const std::function<void(int, int)>& callback) const;
+
+  bool Empty() const;
+
+  // Number of existing fields.
+  int64_t Size() const;
+
+  static int ChunkCoordinate(int coordinate);
+  static int IndexInChunk(int x, int y);
+  static int CountFields(const Chunk& chunk);
+
+ private:
+  // A check of a chunk added with @AddChunk(), made on its first use.
+  struct PendingCheck {
+    std::shared_ptr<const ChunkValidator> validator;
+    int number_of_fields;
+    std::once_flag once;
+    bool valid;
+  };
+
+  struct Entry {
+    Entry();
+    explicit Entry(std::shared_ptr<Chunk> chunk);
+    Entry(const Entry& other);
+    Entry& operator=(const Entry& other);
+
+    // Null when the chunk is paged out.  Const methods read paged out chunks
+    // back, so it is accessed with std::atomic_load() and
+    // std::atomic_compare_exchange_strong() there.
+    mutable std::shared_ptr<Chunk> chunk;
+    // The copy of the chunk in the spill file, if it is up to date.
+    std::shared_ptr<const ChunkSlot> slot;
+    // @Chunk::max_update_time, kept while the chunk is paged out.
+    int64_t max_update_time;
+    // Value of @write_clock_ at the last modification.
+    uint64_t last_write;
+    // Hash of the fields of the chunk, 0 until computed.  Shared by the
+    // copies of the entry until the chunk is modified.
+    std::shared_ptr<std::atomic<uint64_t>> hash;
+    // Null unless the chunk still has to be checked.  Shared by the copies of
+    // the entry, so that the chunk is checked once.
+    std::shared_ptr<PendingCheck> check;
+  };
+
+  static uint64_t ChunkKey(int chunk_x, int chunk_y);
+  // True when the entries certainly hold the same chunk: the same one in
+  // memory or the same copy in the spill file.
+  static bool SameChunk(const Entry& a, const Entry& b);
+  // Computes the hash of the chunk of @entry, if not computed yet.
+  uint64_t ChunkHash(const Entry& entry) const;
+  // True when field @index is the same in both chunks: missing from both,
+  // or existing in both with the same look.
+  bool SameField(const Chunk& chunk, const FieldStore& other,
+                 const Chunk& other_chunk, int index) const;
+
+  // Reads a paged out chunk back.  Returns nullptr on I/O errors.
+  std::shared_ptr<Chunk> ReadChunk(const Entry& entry) const;
+  // Returns the chunk of @entry.  A paged out chunk is read for the caller
+  // only, so that going over a large board doesn't bring all of it back
+  // into memory.
+  std::shared_ptr<Chunk> PeekChunk(const Entry& entry) const;
+  // Stands for chunks that can't be read back.  Never modified.
+  static const std::shared_ptr<Chunk>& EmptyChunk();
+  // Returns @chunk of @entry, or @EmptyChunk() when it fails the check.
+  static std::shared_ptr<Chunk> CheckedChunk(const Entry& entry,
+                                             std::shared_ptr<Chunk> chunk);
+  // Part of @ForEachInRect() inside one chunk.
+  static void ForEachInChunkRect(
+      int chunk_x, int chunk_y, const Chunk& chunk, int x0, int y0, int x1,
+      int y1, const std::function<void(int, int, FieldView)>& callback);
+  // Returns the chunk of @entry, reading it back if needed.
+  std::shared_ptr<Chunk> LoadChunk(const Entry& entry) const;
+
+  // Returns a chunk that is not shared with any other store, or @scratch_
+  // when the chunk can't be read back.
+  Chunk* FindChunk(int x, int y);
+  // Same, but creates an empty chunk when there is none.
+  Chunk* FindOrCreateChunk(int x, int y, int64_t default_time);
+  const Chunk* FindChunk(int x, int y) const;
+
+  std::unordered_map<uint64_t, Entry> chunks_;
+  int64_t size_;
+  std::shared_ptr<LabelTable> labels_;
+  // Indexed with ids; null for undefined styles.
+  std::shared_ptr<const std::vector<std::shared_ptr<const Style>>> styles_;
+  // Chunks read back by const methods are counted too.
+  mutable std::atomic<int64_t> resident_chunks_;
+  // Shared by the copies of the store.
+  std::shared_ptr<std::atomic<int64_t>> read_errors_;
+  uint64_t write_clock_;
+  // Handed out for writing instead of the chunks that can't be read back.
+  // Not copied.
+  std::unique_ptr<Chunk> scratch_;
+
+  // The map entry of the most recently used chunk.  Consecutive lookups
+  // usually hit the same chunk, which saves a hash probe.
+  uint64_t last_key_;
+  Entry* last_entry_;
+};
+
+class FieldStore::Delta {
+ public:
+  Delta();
+
+ private:
+  friend class FieldStore;
+
+  // Chunks that are new or differ from the chunks of the base.
+  std::vector<std::pair<uint64_t, Entry>> changed_;
+  // Keys of the chunks of the base that the store doesn't have.
+  std::vector<uint64_t> removed_;
+  // The rest of the store.
+  int64_t size_;
+  std::shared_ptr<LabelTable> labels_;
+  std::shared_ptr<const std::vector<std::shared_ptr<const Style>>> styles_;
+  uint64_t write_clock_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_FIELD_STORE_H_
@@ -0,0 +1,75 @@
+#include "label_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace Grid {
+
+LabelCache::LabelCache(size_t max_tiles)
+    : max_tiles_(max_tiles), provider_(), tiles_(), clock_(0) {
+  assert(max_tiles > 0);
+}
+
+const std::string& LabelCache::Get(
+    const std::shared_ptr<const Provider>& provider, int x, int y,
+    uint64_t stamp) {
+  if (provider != provider_) {
+    tiles_.clear();
+    provider_ = provider;
+  }
+  // 0 marks labels that are not made yet.
+  stamp |= 1;
+  Tile& tile = FindOrCreateTile(x, y);
+  const int index = FieldStore::IndexInChunk(x, y);
+  if (tile.stamps[index] != stamp) {
+    std::string& label = tile.labels[index];
+    /* Label */ {
+      StreamReader reader(
+          [&label](const std::string& text) -> void {
+            label = text;
+          });
+      (*provider_)(x, y, reader);
+    }
+    tile.stamps[index] = stamp;
+  }
+  return tile.labels[index];
+}
+
+LabelCache::Tile& LabelCache::FindOrCreateTile(int x, int y) {
+  const uint64_t key =
+      (static_cast<uint64_t>(static_cast<uint32_t>(
+           FieldStore::ChunkCoordinate(x))) << 32) |
+      static_cast<uint32_t>(FieldStore::ChunkCoordinate(y));
+  auto it = tiles_.find(key);
+  if (it == tiles_.end()) {
+    if (tiles_.size() >= max_tiles_) {
+      DropOldTiles();
+    }
+    std::unique_ptr<Tile> tile(new Tile);
+    std::fill_n(tile->stamps, FieldStore::kChunkArea, 0);
+    it = tiles_.emplace(key, std::move(tile)).first;
+  }
+  it->second->last_use = ++clock_;
+  return *it->second;
+}
+
+void LabelCache::DropOldTiles() {
+  std::vector<uint64_t> uses;
+  uses.reserve(tiles_.size());
+  for (const auto& tile : tiles_) {
+    uses.push_back(tile.second->last_use);
+  }
+  auto middle = uses.begin() + uses.size() / 2;
+  std::nth_element(uses.begin(), middle, uses.end());
+  const uint64_t threshold = *middle;
+  for (auto it = tiles_.begin(); it != tiles_.end();) {
+    if (it->second->last_use <= threshold) {
+      it = tiles_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace Grid
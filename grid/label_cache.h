@@ -0,0 +1,54 @@
+#ifndef GRID_LABEL_CACHE_H_
+#define GRID_LABEL_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "field_store.h"
+#include "stream_reader.h"
+
+namespace Grid {
+
+// Labels made on demand by a label provider (see
+// Controller::SetLabelProvider()), cached in tiles of
+// FieldStore::kChunkSize x FieldStore::kChunkSize fields.  When there are too
+// many tiles, the least recently used half is dropped.  Not thread-safe.
+class LabelCache {
+ public:
+  using Provider = std::function<void(int x, int y, StreamReader& label)>;
+
+  explicit LabelCache(size_t max_tiles);
+
+  LabelCache(const LabelCache&) = delete;
+  LabelCache& operator=(const LabelCache&) = delete;
+
+  // Returns the label of field (@x, @y) made by @provider.  The label is made
+  // again when @stamp differs from the one it was made with, and everything
+  // is dropped when @provider changes.  The reference stays valid until the
+  // next call.
+  const std::string& Get(const std::shared_ptr<const Provider>& provider,
+                         int x, int y, uint64_t stamp);
+
+ private:
+  struct Tile {
+    std::string labels[FieldStore::kChunkArea];
+    // 0 when the label is not made yet.
+    uint64_t stamps[FieldStore::kChunkArea];
+    uint64_t last_use;
+  };
+
+  Tile& FindOrCreateTile(int x, int y);
+  void DropOldTiles();
+
+  const size_t max_tiles_;
+  std::shared_ptr<const Provider> provider_;
+  std::unordered_map<uint64_t, std::unique_ptr<Tile>> tiles_;
+  uint64_t clock_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_LABEL_CACHE_H_
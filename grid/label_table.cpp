@@ -0,0 +1,85 @@
+#include "label_table.h"
+
+#include <cassert>
+
+namespace Grid {
+
+constexpr int LabelTable::kFirstBlockBits;
+constexpr uint32_t LabelTable::kFirstBlockSize;
+constexpr int LabelTable::kMaxBlocks;
+constexpr uint32_t LabelTable::kProbeId;
+
+size_t LabelTable::IdHash::operator()(uint32_t id) const {
+  return std::hash<std::string>()(table->GetOrProbe(id));
+}
+
+bool LabelTable::IdEqual::operator()(uint32_t a, uint32_t b) const {
+  return table->GetOrProbe(a) == table->GetOrProbe(b);
+}
+
+LabelTable::LabelTable()
+    : size_(0), probe_(nullptr),
+      ids_(0, IdHash{this}, IdEqual{this}) {
+  for (int i = 0; i < kMaxBlocks; i++) {
+    blocks_[i].store(nullptr, std::memory_order_relaxed);
+  }
+  // The empty label gets id 0.
+  Intern(std::string());
+}
+
+LabelTable::~LabelTable() {
+  for (int i = 0; i < kMaxBlocks; i++) {
+    delete[] blocks_[i].load(std::memory_order_relaxed);
+  }
+}
+
+uint32_t LabelTable::Intern(const std::string& label) {
+  probe_ = &label;
+  auto it = ids_.find(kProbeId);
+  probe_ = nullptr;
+  if (it != ids_.end()) {
+    return *it;
+  }
+  const uint32_t id = size_.load(std::memory_order_relaxed);
+  assert(id < kProbeId - kFirstBlockSize);
+  int block;
+  uint32_t index;
+  Locate(id, block, index);
+  std::string* block_data = blocks_[block].load(std::memory_order_relaxed);
+  if (block_data == nullptr) {
+    block_data = new std::string[kFirstBlockSize << block];
+    blocks_[block].store(block_data, std::memory_order_release);
+  }
+  block_data[index] = label;
+  size_.store(id + 1, std::memory_order_release);
+  ids_.insert(id);
+  return id;
+}
+
+const std::string& LabelTable::Get(uint32_t id) const {
+  assert(id < size_.load(std::memory_order_acquire));
+  int block;
+  uint32_t index;
+  Locate(id, block, index);
+  return blocks_[block].load(std::memory_order_acquire)[index];
+}
+
+uint32_t LabelTable::Size() const {
+  return size_.load(std::memory_order_acquire);
+}
+
+const std::string& LabelTable::GetOrProbe(uint32_t id) const {
+  if (id == kProbeId) {
+    return *probe_;
+  }
+  return Get(id);
+}
+
+void LabelTable::Locate(uint32_t id, int& block, uint32_t& index) {
+  const uint32_t shifted = id + kFirstBlockSize;
+  const int bits = 31 - __builtin_clz(shifted);
+  block = bits - kFirstBlockBits;
+  index = shifted - (uint32_t(1) << bits);
+}
+
+}  // namespace Grid
@@ -0,0 +1,69 @@
+#ifndef GRID_LABEL_TABLE_H_
+#define GRID_LABEL_TABLE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_set>
+
+namespace Grid {
+
+// Interns field labels.  Every distinct label is stored once and is identified
+// by a stable id; id 0 is always the empty label.  Labels are never removed,
+// so a reference returned by @Get() stays valid as long as the table lives.
+//
+// Only one thread can call @Intern() at a time, but @Get() can be called by
+// any thread concurrently, as long as the id was handed to it in a properly
+// synchronized way.
+class LabelTable {
+ public:
+  LabelTable();
+  ~LabelTable();
+
+  LabelTable(const LabelTable&) = delete;
+  LabelTable& operator=(const LabelTable&) = delete;
+
+  uint32_t Intern(const std::string& label);
+
+  const std::string& Get(uint32_t id) const;
+
+  // Number of distinct labels, including the empty one.
+  uint32_t Size() const;
+
+ private:
+  // Block b holds ids [kFirstBlockSize * (2^b - 1), kFirstBlockSize *
+  // (2^(b+1) - 1)), so a new table takes little memory and the blocks double
+  // as it grows.
+  static constexpr int kFirstBlockBits = 4;
+  static constexpr uint32_t kFirstBlockSize = 1 << kFirstBlockBits;
+  static constexpr int kMaxBlocks = 32 - kFirstBlockBits;
+  // Never a valid id.  Used to look up strings that are not interned yet.
+  static constexpr uint32_t kProbeId = ~uint32_t(0);
+
+  struct IdHash {
+    const LabelTable* table;
+    size_t operator()(uint32_t id) const;
+  };
+
+  struct IdEqual {
+    const LabelTable* table;
+    bool operator()(uint32_t a, uint32_t b) const;
+  };
+
+  const std::string& GetOrProbe(uint32_t id) const;
+  // Finds the block of @id and the index of @id in it.
+  static void Locate(uint32_t id, int& block, uint32_t& index);
+
+  // Labels are stored in blocks, which are never moved.  Pointers to the
+  // blocks are atomic, because readers don't take any lock.
+  std::atomic<std::string*> blocks_[kMaxBlocks];
+  std::atomic<uint32_t> size_;
+
+  const std::string* probe_;
+  std::unordered_set<uint32_t, IdHash, IdEqual> ids_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_LABEL_TABLE_H_
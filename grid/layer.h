@@ -0,0 +1,34 @@
+#ifndef GRID_LAYER_H_
+#define GRID_LAYER_H_
+
+namespace Grid {
+
+// Fields are drawn in independent layers, bottom to top.  Every layer is
+// cached by the painter separately, so a change redraws only the layers it
+// touched.
+enum class Layer : int {
+  // Background color.
+  kTerrain = 0,
+  kObjects = 1,
+  kLabels  = 2,
+  // Border and fog.
+  kOverlay = 3,
+
+  // Not actually a layer.
+  kCount = 4,
+};
+
+constexpr int kNumberOfLayers = static_cast<int>(Layer::kCount);
+
+// Set of layers, one bit per layer.
+using LayerMask = unsigned;
+
+constexpr LayerMask LayerBit(Layer layer) {
+  return LayerMask(1) << static_cast<int>(layer);
+}
+
+constexpr LayerMask kAllLayers = (LayerMask(1) << kNumberOfLayers) - 1;
+
+}  // namespace Grid
+
+#endif  // GRID_LAYER_H_
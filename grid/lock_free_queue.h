@@ -28,6 +28,10 @@ class LockFreeQueue {
   // (i.e. it will not be returned with the next call to @Consume*()).
   void ConsumeBlock(T& t);
 
+  // Same as @ConsumeBlock(), but also returns (with false) when @Interrupt()
+  // has been called since the last return.
+  bool ConsumeBlockOrInterrupt(T& t);
+
   // Returns true when the queue is empty.
   bool IsEmpty();
 
@@ -38,6 +42,10 @@ class LockFreeQueue {
   // (there are @Size or more elements), actively waits for some free space.
   void Append(T t);
 
+  // Wakes up the reader waiting in @ConsumeBlockOrInterrupt().  Can be called
+  // by any thread.
+  void Interrupt();
+
  private:
   std::mutex mutex_;
   std::condition_variable cond_var_;
@@ -45,6 +53,7 @@ class LockFreeQueue {
   int begin_;
   int end_;
   std::atomic<int> length_;
+  std::atomic<bool> interrupted_;
   T array_[Size];
 };
 
@@ -54,7 +63,8 @@ class LockFreeQueue {
 // -------------------------------------------------------------------------- //
 
 template <typename T, int Size>
-LockFreeQueue<T, Size>::LockFreeQueue() : begin_(0), end_(0), length_(0) {}
+LockFreeQueue<T, Size>::LockFreeQueue()
+    : begin_(0), end_(0), length_(0), interrupted_(false) {}
 
 template <typename T, int Size>
 bool LockFreeQueue<T, Size>::Consume(T& t) {
@@ -84,6 +94,25 @@ void LockFreeQueue<T, Size>::ConsumeBlock(T& t) {
   length_.fetch_sub(1);
 }
 
+template <typename T, int Size>
+bool LockFreeQueue<T, Size>::ConsumeBlockOrInterrupt(T& t) {
+  if (length_.load() == 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_var_.wait(lock, [this]() -> bool {
+                          return length_.load() != 0 or interrupted_.load();
+                        });
+  }
+  if (interrupted_.exchange(false) and length_.load() == 0) {
+    return false;
+  }
+  t = array_[begin_];
+  if (++begin_ == Size) {
+    begin_ = 0;
+  }
+  length_.fetch_sub(1);
+  return true;
+}
+
 template <typename T, int Size>
 bool LockFreeQueue<T, Size>::IsEmpty() {
   return length_.load() > 0;
@@ -102,6 +131,13 @@ void LockFreeQueue<T, Size>::Append(T t) {
   cond_var_.notify_one();
 }
 
+template <typename T, int Size>
+void LockFreeQueue<T, Size>::Interrupt() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  interrupted_.store(true);
+  cond_var_.notify_one();
+}
+
 }  // namespace Grid
 
 #endif  // GRID_LOCK_FREE_QUEUE_H_
@@ -37,6 +37,22 @@ void Options::SetNumberOfFieldsProcessedPerFrame(int number_of_fields) {
   number_of_fields_processed_per_frame_ = number_of_fields;
 }
 
+int Options::PainterThreads() const {
+  return painter_threads_;
+}
+
+void Options::SetPainterThreads(int threads) {
+  painter_threads_ = threads;
+}
+
+int64_t Options::TileCacheBudget() const {
+  return tile_cache_budget_;
+}
+
+void Options::SetTileCacheBudget(int64_t bytes) {
+  tile_cache_budget_ = bytes;
+}
+
 double Options::InitialScale() const {
   return initial_scale_;
 }
@@ -69,6 +85,67 @@ void Options::SetNullColor(int color) {
   null_color_ = color;
 }
 
+const Colormap& Options::FieldColormap() const {
+  return field_colormap_;
+}
+
+void Options::SetFieldColormap(const Colormap& colormap) {
+  field_colormap_ = colormap;
+}
+
+float Options::FieldValueMin() const {
+  return field_value_min_;
+}
+
+float Options::FieldValueMax() const {
+  return field_value_max_;
+}
+
+void Options::SetFieldValueRange(float min, float max) {
+  field_value_min_ = min;
+  field_value_max_ = max;
+}
+
+int64_t Options::ChunkMemoryBudget() const {
+  return chunk_memory_budget_;
+}
+
+void Options::SetChunkMemoryBudget(int64_t bytes) {
+  chunk_memory_budget_ = bytes;
+}
+
+const std::string& Options::SpillDirectory() const {
+  return spill_directory_;
+}
+
+void Options::SetSpillDirectory(const std::string& directory) {
+  spill_directory_ = directory;
+}
+
+double Options::LabelProviderMinScale() const {
+  return label_provider_min_scale_;
+}
+
+void Options::SetLabelProviderMinScale(double scale) {
+  label_provider_min_scale_ = scale;
+}
+
+bool Options::IndexFields() const {
+  return index_fields_;
+}
+
+void Options::SetIndexFields(bool index) {
+  index_fields_ = index;
+}
+
+int Options::HistoryLength() const {
+  return history_length_;
+}
+
+void Options::SetHistoryLength(int turns) {
+  history_length_ = turns;
+}
+
 double Options::MessageBoxesMargin() const {
   return message_boxes_margin_;
 }
@@ -1,6 +1,10 @@
 #ifndef GRID_OPTIONS_H_
 #define GRID_OPTIONS_H_
 
+#include <cstdint>
+#include <string>
+
+#include "colormap.h"
 #include "controller.h"
 
 namespace Grid {
@@ -22,6 +26,19 @@ class Options {
   int NumberOfFieldsProcessedPerFrame() const;
   void SetNumberOfFieldsProcessedPerFrame(int number_of_fields);
 
+  // Number of threads drawing the fields; 0, the default, uses one per core.
+  // Each thread draws @NumberOfFieldsProcessedPerFrame() fields per frame.
+  int PainterThreads() const;
+  void SetPainterThreads(int threads);
+
+  // Drawn parts of the board are kept for up to that many bytes, at every
+  // scale they were drawn at.  Zooming back to a scale redraws only the parts
+  // that changed since, and zooming to a new one shows the nearest scale
+  // until the fields are drawn.  The window and a margin around it are kept,
+  // about 50 MB per scale for a 1920x1080 window.  0 keeps nothing.
+  int64_t TileCacheBudget() const;
+  void SetTileCacheBudget(int64_t bytes);
+
   double InitialScale() const;
   void SetInitialScale(double scale);
 
@@ -36,6 +53,52 @@ class Options {
   int NullColor() const;
   void SetNullColor(int color);
 
+  // Fields set with Controller::SetFieldValue() are colored with the
+  // colormap: values from @min to @max are mapped onto the whole colormap,
+  // values outside of the range are clamped; @min must be smaller than
+  // @max.  Can be changed later with Controller::SetColormap() and
+  // Controller::SetValueRange().
+  const Colormap& FieldColormap() const;
+  void SetFieldColormap(const Colormap& colormap);
+  float FieldValueMin() const;
+  float FieldValueMax() const;
+  void SetFieldValueRange(float min, float max);
+
+  // When the chunks of the board take more than @bytes of memory, the ones
+  // far from the visible part and not modified recently are moved to a
+  // temporary file in @SpillDirectory() and read back when needed.  The
+  // budget is checked by Controller::SetFog(), at the end of batches and
+  // after region uploads.  When the file can't be created or written, the
+  // rest of the board stays in memory.  0, the default, keeps the whole
+  // board in memory.
+  int64_t ChunkMemoryBudget() const;
+  void SetChunkMemoryBudget(int64_t bytes);
+  const std::string& SpillDirectory() const;
+  void SetSpillDirectory(const std::string& directory);
+
+  // Labels made by Controller::SetLabelProvider() are drawn only when a
+  // field is at least that many pixels large.
+  double LabelProviderMinScale() const;
+  void SetLabelProviderMinScale(double scale);
+
+  // Keeps indexes of fields by object type, by color and by style, which make
+  // Controller::FindObjects() and friends take time proportional to the
+  // number of fields found rather than to the size of the board.  Costs some
+  // memory and time per modified field, so it is off by default.
+  bool IndexFields() const;
+  void SetIndexFields(bool index);
+
+  // The board is remembered at every Controller::SetFog(), for up to that
+  // many turns, and the viewer can go back to them: ctrl+left and
+  // ctrl+right step one turn, ctrl+page_up and ctrl+page_down ten turns,
+  // ctrl+home goes to the oldest turn and ctrl+end back to the current
+  // board.  Turns share the chunks of fields they don't change, so a turn
+  // costs memory in proportion to the part of the board it changed.  Chunks
+  // kept by past turns stay in memory even when the board is over
+  // @ChunkMemoryBudget().  0, the default, keeps no history.
+  int HistoryLength() const;
+  void SetHistoryLength(int turns);
+
   double MessageBoxesMargin() const;
   void SetMessageBoxesMargin(double margin);
 
@@ -54,6 +117,10 @@ class Options {
 
   int number_of_fields_processed_per_frame_ = 1000;
 
+  int painter_threads_ = 0;
+
+  int64_t tile_cache_budget_ = int64_t(256) << 20;
+
   double initial_scale_ = 100.0;
 
   double scroll_speed_ = 15.0;
@@ -61,6 +128,19 @@ class Options {
 
   int null_color_ = 200;
 
+  Colormap field_colormap_ = Colormap::Viridis();
+  float field_value_min_ = 0.0;
+  float field_value_max_ = 1.0;
+
+  int64_t chunk_memory_budget_ = 0;
+  std::string spill_directory_ = "/tmp";
+
+  double label_provider_min_scale_ = 40.0;
+
+  bool index_fields_ = false;
+
+  int history_length_ = 0;
+
   double message_boxes_margin_ = 10;
   double main_message_box_max_width_ = 300;
   double single_box_message_height_ = 25;
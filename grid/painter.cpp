@@ -1,7 +1,10 @@
 #include "painter.h"
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <limits>
 #include <thread>
 
 #include "board.h"
@@ -13,6 +16,40 @@
 
 namespace Grid {
 
+namespace {
+
+// Tiles drawn in parallel are that many pixels wide and high.
+constexpr int kTileSize = 128;
+
+// Tiles copied into the tile cache per iteration of the drawing loop.
+constexpr int kTilesCachedPerIteration = 8;
+
+// Buckets of the draw queue (see Painter::DrawPriority()).  The window and
+// the rest of the surface are split into that many rings around the middle
+// of the window.
+constexpr int kWindowRings = 8;
+constexpr int kSurfaceRings = 6;
+constexpr int kInvalidatedInWindowBucket = 0;
+constexpr int kFillInWindowBucket = kInvalidatedInWindowBucket + 1;
+constexpr int kInvalidatedOnSurfaceBucket = kFillInWindowBucket + kWindowRings;
+constexpr int kFillOnSurfaceBucket = kInvalidatedOnSurfaceBucket + 1;
+static_assert(kFillOnSurfaceBucket + kSurfaceRings <= DrawQueue::kBuckets,
+              "Too few buckets in the draw queue.");
+
+// An image surface on the pixels of the rectangle
+// [x, x + width) x [y, y + height) of @surface.  Views of disjoint
+// rectangles can be drawn on by different threads at once.
+Cairo::RefPtr<Cairo::ImageSurface> TileView(
+    const Cairo::RefPtr<Cairo::ImageSurface>& surface, int x, int y,
+    int width, int height) {
+  // Both formats in use take 4 bytes per pixel.
+  return Cairo::ImageSurface::create(
+      surface->get_data() + y * surface->get_stride() + x * 4,
+      surface->get_format(), width, height, surface->get_stride());
+}
+
+}  // namespace
+
 Painter::Painter(const Options* options, Board* board, int width, int height)
     : options_(options), board_(board), viewer_(nullptr),
       modification_{width / 2.0, height / 2.0, options->InitialScale(),
@@ -20,7 +57,15 @@ Painter::Painter(const Options* options, Board* board, int width, int height)
       // Values: @width_, @height_, @tx_, @ty_, @micro_dx_, @micro_dy_, @scale_
       // will be initialized after first modification.
       width_(0), height_(0),
-      tx_(0), ty_(0), micro_dx_(0), micro_dy_(0), scale_(1) {
+      tx_(0), ty_(0), micro_dx_(0), micro_dy_(0), scale_(1),
+      showing_zoom_preview_(false),
+      tile_cache_(options->TileCacheBudget()), tiles_to_cache_(),
+      tiles_queued_(false),
+      workers_(new WorkerPool(
+          options->PainterThreads() > 0
+              ? options->PainterThreads()
+              : static_cast<int>(
+                    std::max(1u, std::thread::hardware_concurrency())))) {
   assert(width > 0);
   assert(height > 0);
   // Sets up main surfaces.
@@ -30,12 +75,16 @@ Painter::Painter(const Options* options, Board* board, int width, int height)
   }
   current_main_surface_ = 0;
   context_ = Cairo::Context::create(main_surface_[current_main_surface_]);
+  CreateLayerSurfaces(width * 2, height * 2);
   // Sets up surface buffers.
   for (int i = 0; i < 3; i++) {
     surface_buffers_[i].surface = Cairo::ImageSurface::create(
         Cairo::Format::FORMAT_RGB24, width * 2, height * 2);
     surface_buffers_[i].start_x = 0;
     surface_buffers_[i].start_y = 0;
+    surface_buffers_[i].tx = 0;
+    surface_buffers_[i].ty = 0;
+    surface_buffers_[i].scale = 1;
     surface_buffer_updater_.AddObject(&surface_buffers_[i]);
   }
   surface_buffer_updater_.SetCurrentObject(
@@ -94,35 +143,100 @@ void Painter::Zoom(double x, double y, double factor) {
   TrySetModification();
 }
 
-void Painter::InvalidateField(int x, int y) {
-  std::lock_guard<std::mutex> lock(update_mutex_);
-  task_queue_.Append([this, x, y]() -> void {
-                       fields_to_draw_.emplace(x, y);
-                     });
+void Painter::InvalidateField(int x, int y, LayerMask layers) {
+  bool wake_up = false;
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    if ((layers & LayerBit(static_cast<Layer>(layer))) and
+        dirty_fields_[layer].Add(x, y)) {
+      wake_up = true;
+    }
+  }
+  if (wake_up) {
+    task_queue_.Interrupt();
+  }
 }
 
-void Painter::InvalidateEverything() {
+void Painter::InvalidateFields(
+    const std::vector<std::pair<int, int>>& fields, LayerMask layers) {
+  bool wake_up = false;
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    if (!(layers & LayerBit(static_cast<Layer>(layer)))) {
+      continue;
+    }
+    for (const auto& field : fields) {
+      if (dirty_fields_[layer].Add(field.first, field.second)) {
+        wake_up = true;
+      }
+    }
+  }
+  if (wake_up) {
+    task_queue_.Interrupt();
+  }
+}
+
+void Painter::InvalidateEverything(LayerMask layers) {
   std::lock_guard<std::mutex> lock(update_mutex_);
   task_queue_.Append(
-      [this]() -> void {
+      [this, layers]() -> void {
+        tile_cache_.Clear();
+        tiles_queued_ = false;
         auto upper_left = SurfaceToBoardCoordinates(0, 0);
         auto lower_right = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
-        fields_to_draw_.clear();
-        board_->IterateFieldsInRectangle(
-            upper_left.first, upper_left.second,
-            lower_right.first, lower_right.second,
-            [this](int x, int y) -> void {
-              fields_to_draw_.emplace(x, y);
-            });
+        if (layers != kAllLayers) {
+          // Other layers are still valid, nothing is cleared.
+          board_->IterateFieldsInRectangle(
+              upper_left.first, upper_left.second,
+              lower_right.first, lower_right.second,
+              [this, layers](int x, int y) -> void {
+                fields_to_draw_.Add(x, y, layers,
+                                    DrawPriority(x, y, false));
+              });
+          return;
+        }
+        fields_to_draw_.Clear();
+        QueueRectangle(upper_left.first, upper_left.second,
+                       lower_right.first, lower_right.second);
         context_->save();
           const double null_color = options().NullColor() / 255.0;
           context_->set_source_rgb(null_color, null_color, null_color);
           context_->paint();
         context_->restore();
+        ClearLayers();
         UpdateCurrentSurface();
       });
 }
 
+void Painter::InvalidateRegion(int x0, int y0, int x1, int y1,
+                               LayerMask layers) {
+  std::lock_guard<std::mutex> lock(update_mutex_);
+  task_queue_.Append(
+      [this, x0, y0, x1, y1, layers]() -> void {
+        double left = std::numeric_limits<double>::max();
+        double top = std::numeric_limits<double>::max();
+        double right = std::numeric_limits<double>::lowest();
+        double bottom = std::numeric_limits<double>::lowest();
+        for (int corner = 0; corner < 4; corner++) {
+          const auto center = board_->CenterOfField(
+              corner & 1 ? x1 : x0, corner >> 1 ? y1 : y0);
+          left = std::min(left, center.first);
+          top = std::min(top, center.second);
+          right = std::max(right, center.first);
+          bottom = std::max(bottom, center.second);
+        }
+        tile_cache_.MarkChanged(left, top, right, bottom);
+        auto upper_left = SurfaceToBoardCoordinates(0, 0);
+        auto lower_right = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
+        board_->IterateFieldsInRectangle(
+            upper_left.first, upper_left.second,
+            lower_right.first, lower_right.second,
+            [this, x0, y0, x1, y1, layers](int x, int y) -> void {
+              if (x0 <= x and x <= x1 and y0 <= y and y <= y1) {
+                fields_to_draw_.Add(x, y, layers, DrawPriority(x, y, true));
+              }
+            });
+      });
+}
+
 void Painter::CenterOn(int x, int y) {
   std::lock_guard<std::mutex> lock(update_mutex_);
   const std::pair<double, double> center = board_->CenterOfField(x, y);
@@ -141,6 +255,10 @@ std::pair<int, int> Painter::WindowToBoardCoordinates(double x,
   return board_->PointToCoordinates(board_x, board_y);
 }
 
+const Board& Painter::board() const {
+  return *board_;
+}
+
 const Options& Painter::options() const {
   return *options_;
 }
@@ -166,11 +284,46 @@ void Painter::TrySetModification() {
   task_queue_.Append([this, modification = modification_]() -> void {
                        modifications_waiting_.fetch_sub(1);
                        ApplyModification(&modification);
+                       ReportViewport();
                      });
   is_modification_not_pushed_.store(false);
 }
 
+void Painter::ReportViewport() {
+  int min_x = std::numeric_limits<int>::max();
+  int min_y = std::numeric_limits<int>::max();
+  int max_x = std::numeric_limits<int>::min();
+  int max_y = std::numeric_limits<int>::min();
+  for (int corner = 0; corner < 4; corner++) {
+    const auto point = SurfaceToBoardCoordinates((corner & 1) * width_ * 2,
+                                                 (corner >> 1) * height_ * 2);
+    const auto field = board_->PointToCoordinates(point.first, point.second);
+    min_x = std::min(min_x, field.first);
+    min_y = std::min(min_y, field.second);
+    max_x = std::max(max_x, field.first);
+    max_y = std::max(max_y, field.second);
+  }
+  options().controller()->SetViewport(min_x, min_y, max_x, max_y);
+  // The window shows the middle of the surface.
+  Controller::VisibleRegion region{std::numeric_limits<int>::max(),
+                                   std::numeric_limits<int>::max(),
+                                   std::numeric_limits<int>::min(),
+                                   std::numeric_limits<int>::min(), scale_};
+  for (int corner = 0; corner < 4; corner++) {
+    const auto point = SurfaceToBoardCoordinates(
+        width_ / 2.0 - micro_dx_ + (corner & 1) * width_,
+        height_ / 2.0 - micro_dy_ + (corner >> 1) * height_);
+    const auto field = board_->PointToCoordinates(point.first, point.second);
+    region.min_x = std::min(region.min_x, field.first);
+    region.min_y = std::min(region.min_y, field.second);
+    region.max_x = std::max(region.max_x, field.first);
+    region.max_y = std::max(region.max_y, field.second);
+  }
+  options().controller()->SetVisibleRegion(region);
+}
+
 void Painter::UpdateCurrentSurface() {
+  showing_zoom_preview_ = false;
   SurfaceBuffer* surface_buffer = surface_buffer_updater_.GetFreeObject();
   if (surface_buffer->surface->get_width() != width_ * 2 or
       surface_buffer->surface->get_height() != height_ * 2) {
@@ -180,12 +333,25 @@ void Painter::UpdateCurrentSurface() {
   CopySurface(main_surface_[current_main_surface_], surface_buffer->surface);
   surface_buffer->start_x = -width_ / 2.0 + micro_dx_;
   surface_buffer->start_y = -height_ / 2.0 + micro_dy_;
+  surface_buffer->tx = tx_;
+  surface_buffer->ty = ty_;
+  surface_buffer->scale = scale_;
   surface_buffer_updater_.SetCurrentObject(surface_buffer);
   viewer_->Redraw();
 }
 
 void Painter::DrawLoop() {
   while (true) {
+    for (int layer = 0; layer < kNumberOfLayers; layer++) {
+      dirty_fields_[layer].Drain(
+          [this, layer](int x, int y) -> void {
+            const std::pair<double, double> center =
+                board_->CenterOfField(x, y);
+            tile_cache_.MarkChanged(center.first, center.second);
+            fields_to_draw_.Add(x, y, LayerBit(static_cast<Layer>(layer)),
+                                DrawPriority(x, y, true));
+          });
+    }
     std::function<void()> task;
     bool has_task = task_queue_.Consume(task);
     if (!has_task) {
@@ -195,13 +361,25 @@ void Painter::DrawLoop() {
       }
     }
     if (!has_task and fields_to_draw_.empty()) {
-      has_task = true;
-      task_queue_.ConsumeBlock(task);
+      if (!tiles_queued_) {
+        QueueTilesToCache();
+      }
+      if (tiles_to_cache_.empty()) {
+        if (!task_queue_.ConsumeBlockOrInterrupt(task)) {
+          // New dirty fields.
+          continue;
+        }
+        has_task = true;
+      }
     }
+    options().controller()->PinSnapshot();
+    options().controller()->SetDrawingScale(scale_);
     if (has_task) {
       task();
-    } else {
+    } else if (!fields_to_draw_.empty()) {
       ProcessSomeFields();
+    } else {
+      CacheSomeTiles();
     }
   }
 }
@@ -211,7 +389,18 @@ void Painter::ApplyTranslation(int dx, int dy) {
   auto old_lr = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
   tx_ += dx;
   ty_ += dy;
-  ShiftSurface(options(), main_surface_[current_main_surface_], dx, dy);
+  // Fields still queued moved relative to the window.
+  fields_to_draw_.Rebucket([this](int x, int y, int bucket) -> int {
+    return DrawPriority(x, y, bucket == kInvalidatedInWindowBucket or
+                                  bucket == kInvalidatedOnSurfaceBucket);
+  });
+  ShiftSurface(main_surface_[current_main_surface_], dx, dy,
+               options().NullColor());
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    ShiftSurface(layer_surface_[layer], dx, dy,
+                 static_cast<Layer>(layer) == Layer::kTerrain
+                     ? options().NullColor() : 0);
+  }
   auto ul = SurfaceToBoardCoordinates(0, 0);
   auto lr = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
 
@@ -220,17 +409,13 @@ void Painter::ApplyTranslation(int dx, int dy) {
     board_->IterateFieldsInRectangle(
         left, top, right, bottom,
         [this](int x, int y) -> void {
-          fields_to_draw_.erase(std::make_pair(x, y));
+          fields_to_draw_.Erase(x, y);
         });
   };
 
   auto AddRectangle = [this](
       double left, double top, double right, double bottom) -> void {
-    board_->IterateFieldsInRectangle(
-        left, top, right, bottom,
-        [this](int x, int y) -> void {
-          fields_to_draw_.emplace(x, y);
-        });
+    QueueRectangle(left, top, right, bottom);
   };
 
   if (dx == 0 and dy == 0) {
@@ -282,37 +467,40 @@ void Painter::ApplyZoom(int new_tx, int new_ty, double new_scale) {
   tx_ = new_tx;
   ty_ = new_ty;
   scale_ = new_scale;
-  auto upper_left = SurfaceToBoardCoordinates(0, 0);
-  auto lower_right = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
-  fields_to_draw_.clear();
-  board_->IterateFieldsInRectangle(
-      upper_left.first, upper_left.second,
-      lower_right.first, lower_right.second,
-      [this](int x, int y) -> void {
-        fields_to_draw_.emplace(x, y);
-      });
+  DrawCachedPreview();
+  // The scaled composition is shown until the fields are redrawn.  Only the
+  // existing fields are redrawn, so the surface is filled with the null color
+  // first; the layers are redrawn too, so they are not scaled.
   UpdateCurrentSurface();
+  context_->save();
+    context_->set_source_rgb(options().NullColor() / 255.0,
+                             options().NullColor() / 255.0,
+                             options().NullColor() / 255.0);
+    context_->paint();
+  context_->restore();
+  ClearLayers();
+  fields_to_draw_.Clear();
+  QueueSurface();
+  showing_zoom_preview_ =
+      !fields_to_draw_.EmptyBelow(kInvalidatedOnSurfaceBucket);
+  if (!showing_zoom_preview_) {
+    UpdateCurrentSurface();
+  }
 }
 
 void Painter::ApplyBruteForceModification(int tx, int ty, double scale) {
   tx_ = tx;
   ty_ = ty;
   scale_ = scale;
-  auto upper_left = SurfaceToBoardCoordinates(0, 0);
-  auto lower_right = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
-  fields_to_draw_.clear();
-  board_->IterateFieldsInRectangle(
-      upper_left.first, upper_left.second,
-      lower_right.first, lower_right.second,
-      [this](int x, int y) -> void {
-        fields_to_draw_.emplace(x, y);
-      });
   context_->save();
     context_->set_source_rgb(options().NullColor() / 255.0,
                              options().NullColor() / 255.0,
                              options().NullColor() / 255.0);
     context_->paint();
   context_->restore();
+  ClearLayers();
+  fields_to_draw_.Clear();
+  QueueSurface();
   UpdateCurrentSurface();
 }
 
@@ -320,6 +508,9 @@ void Painter::ApplyModification(const Modification* modification) {
   const int new_tx = static_cast<int>(modification->tx);
   const int new_ty = static_cast<int>(modification->ty);
   const double new_scale = modification->scale;
+  // Tiles are queued again for the new position of the surface.
+  tiles_to_cache_.clear();
+  tiles_queued_ = false;
   micro_dx_ = modification->tx - new_tx;
   micro_dy_ = modification->ty - new_ty;
   if (modification->width != width_ or modification->height != height_) {
@@ -332,6 +523,7 @@ void Painter::ApplyModification(const Modification* modification) {
           Cairo::Format::FORMAT_RGB24, width_ * 2, height_ * 2);
     }
     context_ = Cairo::Context::create(main_surface_[current_main_surface_]);
+    CreateLayerSurfaces(width_ * 2, height_ * 2);
     return ApplyBruteForceModification(new_tx, new_ty, new_scale);
   }
   if (std::abs(scale_ - new_scale) < 1e-9 and
@@ -347,23 +539,405 @@ void Painter::ApplyModification(const Modification* modification) {
 
 void Painter::ProcessSomeFields() {
   if (fields_to_draw_.empty()) return;
-  int min_x, min_y, max_x, max_y;
-  options().controller()->GetExtensions(min_x, min_y, max_x, max_y);
-  int cnt = options().NumberOfFieldsProcessedPerFrame();
-  while (!fields_to_draw_.empty() and cnt-- > 0) {
-    auto it = fields_to_draw_.begin();
-    const int x = it->first;
-    const int y = it->second;
-    fields_to_draw_.erase(it);
-    if (min_x <= x and x <= max_x and min_y <= y and y <= max_y) {
+  // Tiles cached before may show the old look of the fields.
+  tiles_queued_ = false;
+  int cnt = options().NumberOfFieldsProcessedPerFrame() * workers_->threads();
+  std::vector<std::pair<std::pair<int, int>, LayerMask>> fields;
+  int x, y;
+  LayerMask layers;
+  // Fields missing from the pinned board, e.g. ones created after the past
+  // turn shown, are drawn too, as empty fields.
+  while (cnt-- > 0 and fields_to_draw_.Pop(x, y, layers)) {
+    fields.emplace_back(std::make_pair(x, y), layers);
+  }
+  if (workers_->threads() == 1) {
+    for (const auto& field : fields) {
+      DrawFieldLayers(field.first.first, field.first.second, field.second);
+    }
+  } else {
+    DrawFieldsInTiles(fields);
+  }
+  if (showing_zoom_preview_ and
+      !fields_to_draw_.EmptyBelow(kInvalidatedOnSurfaceBucket)) {
+    // A partly drawn window would cover the preview with the null color.
+    // The rest of the surface is drawn after the window is shown.
+    return;
+  }
+  UpdateCurrentSurface();
+}
+
+int Painter::DrawPriority(int x, int y, bool invalidated) const {
+  const std::pair<double, double> center = board_->CenterOfField(x, y);
+  const std::pair<double, double> point =
+      BoardToSurfaceCoordinates(center.first, center.second);
+  // The window shows the middle of the surface.  The distance is 1 on the
+  // border of the window and 2 on the border of the surface.
+  const double dx = std::abs(point.first - (width_ - micro_dx_)) /
+      std::max(width_ / 2.0, 1.0);
+  const double dy = std::abs(point.second - (height_ - micro_dy_)) /
+      std::max(height_ / 2.0, 1.0);
+  const double distance = std::max(dx, dy);
+  if (distance <= 1) {
+    if (invalidated) {
+      return kInvalidatedInWindowBucket;
+    }
+    return kFillInWindowBucket +
+        std::min(static_cast<int>(distance * kWindowRings), kWindowRings - 1);
+  }
+  if (invalidated) {
+    return kInvalidatedOnSurfaceBucket;
+  }
+  return kFillOnSurfaceBucket +
+      std::min(static_cast<int>((distance - 1) * kSurfaceRings),
+               kSurfaceRings - 1);
+}
+
+void Painter::QueueRectangle(double left, double top, double right,
+                             double bottom) {
+  board_->IterateFieldsInRectangle(
+      left, top, right, bottom,
+      [this](int x, int y) -> void {
+        fields_to_draw_.Add(x, y, kAllLayers, DrawPriority(x, y, false));
+      });
+}
+
+void Painter::QueueTilesToCache() {
+  tiles_queued_ = true;
+  tiles_to_cache_.clear();
+  if (!tile_cache_.enabled() or width_ == 0 or showing_zoom_preview_) {
+    return;
+  }
+  const int size = TileCache::kTileSize;
+  const int level = TileCache::Level(scale_);
+  // Tiles entirely on the surface.
+  const int first_x = static_cast<int>(std::ceil(-tx_ / double(size)));
+  const int first_y = static_cast<int>(std::ceil(-ty_ / double(size)));
+  const int last_x =
+      static_cast<int>(std::floor((width_ * 2 - tx_) / double(size))) - 1;
+  const int last_y =
+      static_cast<int>(std::floor((height_ * 2 - ty_) / double(size))) - 1;
+  const double window_left = width_ / 2.0 - micro_dx_;
+  const double window_top = height_ / 2.0 - micro_dy_;
+  // The rest of the surface would take as much memory as three windows,
+  // so only a margin of one tile is kept around the window.  Tiles in the
+  // window are taken first, so they go last.
+  for (int pass = 0; pass < 2; pass++) {
+    const int margin = pass == 0 ? size : 0;
+    for (int tile_y = first_y; tile_y <= last_y; tile_y++) {
+      for (int tile_x = first_x; tile_x <= last_x; tile_x++) {
+        const int left = tile_x * size + tx_;
+        const int top = tile_y * size + ty_;
+        const bool in_window =
+            left < window_left + width_ and left + size > window_left and
+            top < window_top + height_ and top + size > window_top;
+        const bool in_margin =
+            left < window_left + width_ + margin and
+            left + size > window_left - margin and
+            top < window_top + height_ + margin and
+            top + size > window_top - margin;
+        if (in_window != (pass == 1) or !in_margin) {
+          continue;
+        }
+        const TileCache::Tile* tile = FindValidTile(level, tile_x, tile_y);
+        if (tile == nullptr or std::abs(tile->scale / scale_ - 1) > 1e-9) {
+          tiles_to_cache_.emplace_back(tile_x, tile_y);
+        }
+      }
+    }
+  }
+}
+
+void Painter::CacheSomeTiles() {
+  const int size = TileCache::kTileSize;
+  const int level = TileCache::Level(scale_);
+  // Nothing is queued, so the tiles show the fields as they are now.
+  const uint64_t version = tile_cache_.Version();
+  for (int i = 0; i < kTilesCachedPerIteration and !tiles_to_cache_.empty();
+       i++) {
+    const int tile_x = tiles_to_cache_.back().first;
+    const int tile_y = tiles_to_cache_.back().second;
+    tiles_to_cache_.pop_back();
+    const int left = tile_x * size + tx_;
+    const int top = tile_y * size + ty_;
+    TileCache::Tile tile;
+    tile.scale = scale_;
+    tile.version = version;
+    for (int layer = 0; layer < kNumberOfLayers; layer++) {
+      tile.layers[layer] = Cairo::ImageSurface::create(
+          layer_surface_[layer]->get_format(), size, size);
+      const Cairo::RefPtr<Cairo::Context> context =
+          Cairo::Context::create(tile.layers[layer]);
+      context->set_operator(Cairo::Operator::OPERATOR_SOURCE);
+      context->set_source(layer_surface_[layer], -left, -top);
+      context->paint();
+    }
+    tile_cache_.Insert(level, tile_x, tile_y, tile);
+  }
+}
+
+void Painter::DrawCachedPreview() {
+  int level;
+  if (!tile_cache_.NearestLevel(TileCache::Level(scale_), level)) {
+    return;
+  }
+  const int size = TileCache::kTileSize;
+  // Tiles of the level covering the surface.
+  const double factor = scale_ / TileCache::LevelScale(level);
+  const int first_x =
+      static_cast<int>(std::floor(-tx_ / factor / size)) - 1;
+  const int first_y =
+      static_cast<int>(std::floor(-ty_ / factor / size)) - 1;
+  const int last_x =
+      static_cast<int>(std::floor((width_ * 2 - tx_) / factor / size)) + 1;
+  const int last_y =
+      static_cast<int>(std::floor((height_ * 2 - ty_) / factor / size)) + 1;
+  const int64_t surface_tiles =
+      int64_t(width_ * 2 / size + 1) * (height_ * 2 / size + 1);
+  if (int64_t(last_x - first_x + 1) * (last_y - first_y + 1) >
+      surface_tiles * 16) {
+    // Too far from the scale to be worth it.
+    return;
+  }
+  for (int tile_y = first_y; tile_y <= last_y; tile_y++) {
+    for (int tile_x = first_x; tile_x <= last_x; tile_x++) {
+      const TileCache::Tile* tile = FindValidTile(level, tile_x, tile_y);
+      if (tile == nullptr) {
+        continue;
+      }
+      const double tile_factor = scale_ / tile->scale;
       context_->save();
         context_->translate(tx_, ty_);
-        context_->scale(scale_, scale_);
-        board_->DrawField(x, y, context_);
+        context_->scale(tile_factor, tile_factor);
+        context_->rectangle(tile_x * size, tile_y * size, size, size);
+        context_->clip();
+        for (int layer = 0; layer < kNumberOfLayers; layer++) {
+          context_->set_source(tile->layers[layer], tile_x * size,
+                               tile_y * size);
+          context_->paint();
+        }
       context_->restore();
     }
   }
-  UpdateCurrentSurface();
+}
+
+void Painter::QueueSurface() {
+  const int level = TileCache::Level(scale_);
+  int nearest;
+  if (!tile_cache_.NearestLevel(level, nearest) or nearest != level) {
+    auto upper_left = SurfaceToBoardCoordinates(0, 0);
+    auto lower_right = SurfaceToBoardCoordinates(width_ * 2, height_ * 2);
+    QueueRectangle(upper_left.first, upper_left.second,
+                   lower_right.first, lower_right.second);
+    return;
+  }
+  const int size = TileCache::kTileSize;
+  const int first_x = static_cast<int>(std::floor(-tx_ / double(size)));
+  const int first_y = static_cast<int>(std::floor(-ty_ / double(size)));
+  const int last_x =
+      static_cast<int>(std::floor((width_ * 2 - 1 - tx_) / double(size)));
+  const int last_y =
+      static_cast<int>(std::floor((height_ * 2 - 1 - ty_) / double(size)));
+  for (int tile_y = first_y; tile_y <= last_y; tile_y++) {
+    for (int tile_x = first_x; tile_x <= last_x; tile_x++) {
+      const int left = tile_x * size + tx_;
+      const int top = tile_y * size + ty_;
+      const TileCache::Tile* tile = FindValidTile(level, tile_x, tile_y);
+      if (tile == nullptr or std::abs(tile->scale / scale_ - 1) > 1e-9) {
+        // Fields overlapping the tile are drawn whole, also over the
+        // neighbouring tiles, which get the same pixels they had.
+        auto upper_left = SurfaceToBoardCoordinates(std::max(left, 0),
+                                                    std::max(top, 0));
+        auto lower_right = SurfaceToBoardCoordinates(
+            std::min(left + size, width_ * 2),
+            std::min(top + size, height_ * 2));
+        QueueRectangle(upper_left.first, upper_left.second,
+                       lower_right.first, lower_right.second);
+        continue;
+      }
+      for (int layer = 0; layer < kNumberOfLayers; layer++) {
+        const Cairo::RefPtr<Cairo::Context>& context = layer_context_[layer];
+        context->save();
+          context->rectangle(left, top, size, size);
+          context->clip();
+          context->set_operator(Cairo::Operator::OPERATOR_SOURCE);
+          context->set_source(tile->layers[layer], left, top);
+          context->paint();
+        context->restore();
+      }
+      context_->save();
+        context_->rectangle(left, top, size, size);
+        context_->clip();
+        for (int layer = 0; layer < kNumberOfLayers; layer++) {
+          context_->set_source(layer_surface_[layer], 0, 0);
+          context_->paint();
+        }
+      context_->restore();
+    }
+  }
+}
+
+const TileCache::Tile* Painter::FindValidTile(int level, int tile_x,
+                                              int tile_y) {
+  const TileCache::Tile* tile = tile_cache_.Find(level, tile_x, tile_y);
+  if (tile == nullptr) {
+    return nullptr;
+  }
+  // Fields whose centers are that far from the tile can still reach it.
+  constexpr double kMargin = 2;
+  const double size = TileCache::kTileSize / tile->scale;
+  if (tile_cache_.ChangedSince(tile_x * size - kMargin,
+                               tile_y * size - kMargin,
+                               (tile_x + 1) * size + kMargin,
+                               (tile_y + 1) * size + kMargin,
+                               tile->version)) {
+    return nullptr;
+  }
+  return tile;
+}
+
+void Painter::CreateLayerSurfaces(int width, int height) {
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    layer_context_[layer].clear();
+    layer_surface_[layer] = Cairo::ImageSurface::create(
+        static_cast<Layer>(layer) == Layer::kTerrain
+            ? Cairo::Format::FORMAT_RGB24 : Cairo::Format::FORMAT_ARGB32,
+        width, height);
+    layer_context_[layer] = Cairo::Context::create(layer_surface_[layer]);
+  }
+}
+
+void Painter::ClearLayers() {
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    const Cairo::RefPtr<Cairo::Context>& context = layer_context_[layer];
+    context->save();
+      if (static_cast<Layer>(layer) == Layer::kTerrain) {
+        context->set_source_rgb(options().NullColor() / 255.0,
+                                options().NullColor() / 255.0,
+                                options().NullColor() / 255.0);
+      } else {
+        context->set_operator(Cairo::Operator::OPERATOR_CLEAR);
+      }
+      context->paint();
+    context->restore();
+  }
+}
+
+void Painter::DrawFieldsInTiles(
+    const std::vector<std::pair<std::pair<int, int>, LayerMask>>& fields) {
+  const int surface_width = width_ * 2;
+  const int surface_height = height_ * 2;
+  const int tiles_x = (surface_width + kTileSize - 1) / kTileSize;
+  const int tiles_y = (surface_height + kTileSize - 1) / kTileSize;
+  // Indices of the fields overlapping every tile, in drawing order.
+  std::vector<std::vector<int>> fields_of_tiles(tiles_x * tiles_y);
+  for (size_t i = 0; i < fields.size(); i++) {
+    double x1, y1, x2, y2;
+    context_->save();
+      context_->translate(tx_, ty_);
+      context_->scale(scale_, scale_);
+      board_->FieldPath(fields[i].first.first, fields[i].first.second,
+                        context_);
+      context_->set_identity_matrix();
+      context_->get_path_extents(x1, y1, x2, y2);
+      context_->new_path();
+    context_->restore();
+    const int left = std::max(0, static_cast<int>(std::floor(x1)));
+    const int top = std::max(0, static_cast<int>(std::floor(y1)));
+    const int right =
+        std::min(surface_width - 1, static_cast<int>(std::ceil(x2)));
+    const int bottom =
+        std::min(surface_height - 1, static_cast<int>(std::ceil(y2)));
+    for (int tile_y = top / kTileSize; tile_y <= bottom / kTileSize;
+         tile_y++) {
+      for (int tile_x = left / kTileSize; tile_x <= right / kTileSize;
+           tile_x++) {
+        fields_of_tiles[tile_y * tiles_x + tile_x].push_back(i);
+      }
+    }
+  }
+  std::vector<int> tiles;
+  for (int tile = 0; tile < tiles_x * tiles_y; tile++) {
+    if (!fields_of_tiles[tile].empty()) {
+      tiles.push_back(tile);
+    }
+  }
+  // The workers write the pixels directly.
+  main_surface_[current_main_surface_]->flush();
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    layer_surface_[layer]->flush();
+  }
+  workers_->Run(
+      tiles.size(),
+      [this, &fields, &fields_of_tiles, &tiles, tiles_x, surface_width,
+       surface_height](int part) -> void {
+        const int tile = tiles[part];
+        const int origin_x = (tile % tiles_x) * kTileSize;
+        const int origin_y = (tile / tiles_x) * kTileSize;
+        const int width = std::min(kTileSize, surface_width - origin_x);
+        const int height = std::min(kTileSize, surface_height - origin_y);
+        Cairo::RefPtr<Cairo::ImageSurface> layer_views[kNumberOfLayers];
+        Cairo::RefPtr<Cairo::Context> layer_contexts[kNumberOfLayers];
+        for (int layer = 0; layer < kNumberOfLayers; layer++) {
+          layer_views[layer] = TileView(layer_surface_[layer], origin_x,
+                                        origin_y, width, height);
+          layer_contexts[layer] = Cairo::Context::create(layer_views[layer]);
+        }
+        const Cairo::RefPtr<Cairo::Context> context = Cairo::Context::create(
+            TileView(main_surface_[current_main_surface_], origin_x,
+                     origin_y, width, height));
+        for (int i : fields_of_tiles[tile]) {
+          DrawFieldLayers(fields[i].first.first, fields[i].first.second,
+                          fields[i].second, layer_contexts, layer_views,
+                          context, origin_x, origin_y);
+        }
+      });
+  main_surface_[current_main_surface_]->mark_dirty();
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    layer_surface_[layer]->mark_dirty();
+  }
+}
+
+void Painter::DrawFieldLayers(int x, int y, LayerMask layers) {
+  DrawFieldLayers(x, y, layers, layer_context_, layer_surface_, context_, 0,
+                  0);
+}
+
+void Painter::DrawFieldLayers(
+    int x, int y, LayerMask layers,
+    const Cairo::RefPtr<Cairo::Context>* layer_contexts,
+    const Cairo::RefPtr<Cairo::ImageSurface>* layer_surfaces,
+    const Cairo::RefPtr<Cairo::Context>& main_context, int origin_x,
+    int origin_y) {
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    if (!(layers & LayerBit(static_cast<Layer>(layer)))) {
+      continue;
+    }
+    const Cairo::RefPtr<Cairo::Context>& context = layer_contexts[layer];
+    context->save();
+      context->translate(tx_ - origin_x, ty_ - origin_y);
+      context->scale(scale_, scale_);
+      board_->FieldPath(x, y, context);
+      context->clip();
+      // Erases the previous contents of the field on this layer only.
+      context->set_operator(Cairo::Operator::OPERATOR_CLEAR);
+      context->paint();
+      context->set_operator(Cairo::Operator::OPERATOR_OVER);
+      board_->DrawFieldLayer(x, y, static_cast<Layer>(layer), context);
+    context->restore();
+  }
+  // Layers are aligned with the main surface, so they are composited in
+  // device coordinates.
+  main_context->save();
+    main_context->translate(tx_ - origin_x, ty_ - origin_y);
+    main_context->scale(scale_, scale_);
+    board_->FieldPath(x, y, main_context);
+    main_context->set_identity_matrix();
+    main_context->clip();
+    for (int layer = 0; layer < kNumberOfLayers; layer++) {
+      main_context->set_source(layer_surfaces[layer], 0, 0);
+      main_context->paint();
+    }
+  main_context->restore();
 }
 
 }  // namespace Grid
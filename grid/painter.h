@@ -3,12 +3,18 @@
 
 #include <cairomm/context.h>
 #include <cairomm/surface.h>
+#include <memory>
 #include <mutex>
-#include <set>
 #include <utility>
+#include <vector>
 
+#include "dirty_field_set.h"
+#include "draw_queue.h"
+#include "layer.h"
 #include "lock_free_queue.h"
 #include "object_updater.h"
+#include "tile_cache.h"
+#include "worker_pool.h"
 
 namespace Grid {
 
@@ -22,6 +28,11 @@ class Painter {
     Cairo::RefPtr<Cairo::ImageSurface> surface;
     double start_x;
     double start_y;
+    // Point (x, y) of the board is at (x * scale + tx, y * scale + ty) on
+    // the surface.
+    double tx;
+    double ty;
+    double scale;
   };
 
   Painter(const Options* options, Board* board, int width, int height);
@@ -36,12 +47,22 @@ class Painter {
   void Translate(double dx, double dy);
   void Zoom(double x, double y, double factor);
 
-  void InvalidateField(int x, int y);
-  void InvalidateEverything();
+  // Calls to @InvalidateField() and @InvalidateFields() must be serialized by
+  // the caller.  They never wait for the drawing thread.  Only the given
+  // layers of the fields are redrawn.
+  void InvalidateField(int x, int y, LayerMask layers = kAllLayers);
+  void InvalidateFields(const std::vector<std::pair<int, int>>& fields,
+                        LayerMask layers = kAllLayers);
+  void InvalidateEverything(LayerMask layers = kAllLayers);
+  // Fields [x0, x1] x [y0, y1].  Costs as much as the visible part of the
+  // rectangle, not the whole rectangle.
+  void InvalidateRegion(int x0, int y0, int x1, int y1, LayerMask layers);
   void CenterOn(int x, int y);
 
   std::pair<int, int> WindowToBoardCoordinates(double x, double y) const;
 
+  const Board& board() const;
+
  private:
   const Options& options() const;
 
@@ -59,12 +80,56 @@ class Painter {
   // @TrySetModification() requires @update_mutex_ being locked.
   void TrySetModification();
   void UpdateCurrentSurface();
+  // Tells the controller which fields are on the surface, so that their
+  // chunks stay in memory, and which are in the window.
+  void ReportViewport();
   void DrawLoop();
   void ApplyTranslation(int dx, int dy);
   void ApplyZoom(int new_tx, int new_ty, double new_scale);
   void ApplyBruteForceModification(int tx, int ty, double scale);
   void ApplyModification(const Modification* modification);
   void ProcessSomeFields();
+  // Bucket of @fields_to_draw_ for field (@x, @y): fields in the window go
+  // before the rest of the surface, and nearer the middle of the window go
+  // first.  Fields changed by the user (@invalidated) go before the fill of
+  // their part of the surface.
+  int DrawPriority(int x, int y, bool invalidated) const;
+  // Queues all layers of the fields in the rectangle of the board.
+  void QueueRectangle(double left, double top, double right, double bottom);
+  // Queues the tiles of the window and of a margin around it that are not
+  // in @tile_cache_ yet.  Called once nothing is left to draw.
+  void QueueTilesToCache();
+  // Copies a few of the queued tiles of the layers into @tile_cache_, so
+  // that caching doesn't hold back the tasks.
+  void CacheSomeTiles();
+  // Draws the cached tiles of the level nearest to the scale over the main
+  // surface, scaled.
+  void DrawCachedPreview();
+  // Fills the cleared surface: copies the valid cached tiles of the scale and
+  // queues the fields of the rest.
+  void QueueSurface();
+  // Returns nullptr when a field which may show on the tile changed since
+  // it was made.
+  const TileCache::Tile* FindValidTile(int level, int tile_x, int tile_y);
+  void CreateLayerSurfaces(int width, int height);
+  // Fills the terrain with the null color and makes other layers transparent.
+  void ClearLayers();
+  // Redraws the layers of the field and composites it onto the main surface.
+  void DrawFieldLayers(int x, int y, LayerMask layers);
+  // Same, with the given contexts and surfaces, whose pixel (0, 0) is pixel
+  // (@origin_x, @origin_y) of the main surface.
+  void DrawFieldLayers(
+      int x, int y, LayerMask layers,
+      const Cairo::RefPtr<Cairo::Context>* layer_contexts,
+      const Cairo::RefPtr<Cairo::ImageSurface>* layer_surfaces,
+      const Cairo::RefPtr<Cairo::Context>& context, int origin_x,
+      int origin_y);
+  // Draws the fields with all the workers.  The surfaces are split into
+  // square tiles, and every tile is drawn by one worker through its own
+  // contexts on views of the pixels of the tile.  A field is drawn by every
+  // tile it overlaps, clipped to the tile.
+  void DrawFieldsInTiles(
+      const std::vector<std::pair<std::pair<int, int>, LayerMask>>& fields);
 
   const Options* options_;
   Board* board_;
@@ -78,6 +143,8 @@ class Painter {
   std::atomic<bool> is_modification_not_pushed_;
   std::atomic<int> modifications_waiting_;
   LockFreeQueue<std::function<void()>, 50> task_queue_;
+  // One per layer.
+  DirtyFieldSet dirty_fields_[kNumberOfLayers];
 
 
   // -------------------------------- Drawing ------------------------------- //
@@ -88,11 +155,32 @@ class Painter {
   double micro_dx_, micro_dy_;
   double scale_;
 
-  std::set<std::pair<int, int>> fields_to_draw_;
+  // Set after a zoom, while the viewer shows the scaled old surface and the
+  // fields are redrawn.
+  bool showing_zoom_preview_;
+
+  // Layers of the fields which have to be redrawn.
+  DrawQueue fields_to_draw_;
+
+  // Layers of the surfaces at the previous scales.
+  TileCache tile_cache_;
+  // Tiles of the surface waiting to be cached, the next one last.  Copied
+  // only while @fields_to_draw_ is empty.
+  std::vector<std::pair<int, int>> tiles_to_cache_;
+  // False when the surface changed since @tiles_to_cache_ was filled.
+  bool tiles_queued_;
+
+  // The drawing thread is one of the workers.
+  std::unique_ptr<WorkerPool> workers_;
 
+  // The composition of all layers.
   int current_main_surface_;
   Cairo::RefPtr<Cairo::ImageSurface> main_surface_[2];
   Cairo::RefPtr<Cairo::Context> context_;
+  // Every layer is drawn on its own surface, aligned with the main surface.
+  // The terrain is opaque, other layers are transparent.
+  Cairo::RefPtr<Cairo::ImageSurface> layer_surface_[kNumberOfLayers];
+  Cairo::RefPtr<Cairo::Context> layer_context_[kNumberOfLayers];
   SurfaceBuffer surface_buffers_[3];
   ObjectUpdater<SurfaceBuffer> surface_buffer_updater_;
 };
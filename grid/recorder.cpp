@@ -0,0 +1,245 @@
+#include "recorder.h"
+
+#include <cstring>
+
+namespace Grid {
+
+namespace {
+
+constexpr size_t kFlushThreshold = 1 << 20;
+
+}  // namespace
+
+constexpr int Recorder::kDefaultKeyframeInterval;
+
+std::unique_ptr<Recorder> Recorder::Create(const std::string& path,
+                                           int keyframe_interval) {
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  return std::unique_ptr<Recorder>(new Recorder(file, keyframe_interval));
+}
+
+Recorder::Recorder(std::FILE* file, int keyframe_interval)
+    : file_(file), ok_(true), cursor_(0), changes_(),
+      keyframe_interval_(keyframe_interval),
+      records_since_keyframe_(keyframe_interval), buffer_(),
+      start_(std::chrono::steady_clock::now()), last_time_(0),
+      last_x_(0), last_y_(0) {
+  buffer_.append(CommandLog::kMagic, sizeof(CommandLog::kMagic));
+  CommandLog::AppendVarint(buffer_, CommandLog::kVersion);
+}
+
+Recorder::~Recorder() {
+  Close();
+}
+
+void Recorder::SetJournalCursor(uint64_t cursor) {
+  cursor_ = cursor;
+}
+
+void Recorder::ReadJournal(const ChangeJournal& journal,
+                           const FieldStore& fields) {
+  changes_.clear();
+  if (!journal.Read(cursor_, changes_, journal.End() - cursor_)) {
+    ok_ = false;
+    cursor_ = journal.End();
+    return;
+  }
+  for (const FieldChange& change : changes_) {
+    switch (change.kind) {
+      case FieldChange::Kind::kColor:
+        SetFieldColor(change.x, change.y, change.value);
+        break;
+      case FieldChange::Kind::kObject:
+        SetObject(change.x, change.y, change.value);
+        break;
+      case FieldChange::Kind::kText:
+        SetText(change.x, change.y, fields.Label(change.value));
+        break;
+      case FieldChange::Kind::kFog:
+        SetFog();
+        break;
+      case FieldChange::Kind::kClear:
+        Clear();
+        break;
+      case FieldChange::Kind::kValue: {
+        const uint32_t bits = change.value;
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        SetFieldValue(change.x, change.y, value);
+        break;
+      }
+      case FieldChange::Kind::kColorRegion:
+      case FieldChange::Kind::kObjectRegion: {
+        const int width = static_cast<uint64_t>(change.value) >> 32;
+        const int height = static_cast<uint32_t>(change.value);
+        if (change.kind == FieldChange::Kind::kColorRegion) {
+          SetRegionColors(change.x, change.y, width, height,
+                          change.values->data(), width);
+        } else {
+          SetRegionObjects(change.x, change.y, width, height,
+                           change.values->data(), width);
+        }
+        break;
+      }
+      case FieldChange::Kind::kStyle:
+        SetStyle(change.x, change.y, change.value);
+        break;
+      case FieldChange::Kind::kStyleDefinition:
+        DefineStyle(change.value, *fields.FindStyle(change.value));
+        break;
+    }
+  }
+  // Payloads of the changes are not kept alive by the recorder.
+  changes_.clear();
+}
+
+void Recorder::SetFieldColor(int x, int y, int color) {
+  BeginRecord(CommandLog::Opcode::kSetFieldColor);
+  AppendPosition(x, y);
+  CommandLog::AppendVarint(buffer_, static_cast<uint32_t>(color));
+  EndRecord();
+}
+
+void Recorder::SetFieldValue(int x, int y, float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  BeginRecord(CommandLog::Opcode::kSetFieldValue);
+  AppendPosition(x, y);
+  CommandLog::AppendVarint(buffer_, bits);
+  EndRecord();
+}
+
+void Recorder::SetObject(int x, int y, int object) {
+  BeginRecord(CommandLog::Opcode::kSetObject);
+  AppendPosition(x, y);
+  CommandLog::AppendVarint(buffer_, static_cast<uint32_t>(object));
+  EndRecord();
+}
+
+void Recorder::SetText(int x, int y, const std::string& text) {
+  BeginRecord(CommandLog::Opcode::kSetText);
+  AppendPosition(x, y);
+  CommandLog::AppendString(buffer_, text);
+  EndRecord();
+}
+
+void Recorder::SetRegionColors(int x0, int y0, int width, int height,
+                               const uint32_t* values, int stride) {
+  BeginRecord(CommandLog::Opcode::kSetRegionColors);
+  AppendPosition(x0, y0);
+  AppendRegion(width, height, values, stride);
+  EndRecord();
+}
+
+void Recorder::SetRegionObjects(int x0, int y0, int width, int height,
+                                const uint32_t* values, int stride) {
+  BeginRecord(CommandLog::Opcode::kSetRegionObjects);
+  AppendPosition(x0, y0);
+  AppendRegion(width, height, values, stride);
+  EndRecord();
+}
+
+void Recorder::SetStyle(int x, int y, int id) {
+  BeginRecord(CommandLog::Opcode::kSetStyle);
+  AppendPosition(x, y);
+  CommandLog::AppendVarint(buffer_, id);
+  EndRecord();
+}
+
+void Recorder::DefineStyle(int id, const FieldStore::Style& style) {
+  BeginRecord(CommandLog::Opcode::kDefineStyle);
+  CommandLog::AppendVarint(buffer_, id);
+  CommandLog::AppendStyle(buffer_, style);
+  EndRecord();
+}
+
+void Recorder::SetFog() {
+  BeginRecord(CommandLog::Opcode::kSetFog);
+  EndRecord();
+}
+
+void Recorder::CenterOn(int x, int y) {
+  BeginRecord(CommandLog::Opcode::kCenterOn);
+  AppendPosition(x, y);
+  EndRecord();
+}
+
+void Recorder::AddMessage(const std::string& message) {
+  BeginRecord(CommandLog::Opcode::kAddMessage);
+  CommandLog::AppendString(buffer_, message);
+  EndRecord();
+}
+
+void Recorder::Clear() {
+  BeginRecord(CommandLog::Opcode::kClear);
+  EndRecord();
+}
+
+bool Recorder::NeedsKeyframe() const {
+  return records_since_keyframe_ >= keyframe_interval_;
+}
+
+void Recorder::Keyframe(const FieldStore& fields, const BoardFileInfo& info) {
+  std::string board;
+  CommandLog::AppendKeyframe(board, fields, info);
+  BeginRecord(CommandLog::Opcode::kKeyframe);
+  CommandLog::AppendVarint(buffer_, board.size());
+  buffer_ += board;
+  last_x_ = last_y_ = 0;
+  EndRecord();
+  records_since_keyframe_ = 0;
+}
+
+bool Recorder::Close() {
+  if (file_ == nullptr) {
+    return ok_;
+  }
+  ok_ = ok_ and
+      std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+  ok_ = std::fclose(file_) == 0 and ok_;
+  file_ = nullptr;
+  buffer_.clear();
+  return ok_;
+}
+
+void Recorder::BeginRecord(CommandLog::Opcode opcode) {
+  const int64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_).count();
+  buffer_.push_back(static_cast<char>(opcode));
+  CommandLog::AppendVarint(buffer_, time - last_time_);
+  last_time_ = time;
+}
+
+void Recorder::AppendPosition(int x, int y) {
+  CommandLog::AppendVarint(buffer_, CommandLog::ZigZag(int64_t(x) - last_x_));
+  CommandLog::AppendVarint(buffer_, CommandLog::ZigZag(int64_t(y) - last_y_));
+  last_x_ = x;
+  last_y_ = y;
+}
+
+void Recorder::AppendRegion(int width, int height, const uint32_t* values,
+                            int stride) {
+  CommandLog::AppendVarint(buffer_, width);
+  CommandLog::AppendVarint(buffer_, height);
+  for (int y = 0; y < height; y++) {
+    const uint32_t* row = values + static_cast<int64_t>(y) * stride;
+    for (int x = 0; x < width; x++) {
+      CommandLog::AppendVarint(buffer_, row[x]);
+    }
+  }
+}
+
+void Recorder::EndRecord() {
+  records_since_keyframe_++;
+  if (file_ != nullptr and buffer_.size() >= kFlushThreshold) {
+    ok_ = ok_ and
+        std::fwrite(buffer_.data(), 1, buffer_.size(), file_) ==
+            buffer_.size();
+    buffer_.clear();
+  }
+}
+
+}  // namespace Grid
@@ -0,0 +1,95 @@
+#ifndef GRID_RECORDER_H_
+#define GRID_RECORDER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "board_file.h"
+#include "change_journal.h"
+#include "command_log.h"
+#include "field_store.h"
+
+namespace Grid {
+
+// Writes the calls made to the controller to a log (see command_log.h), to
+// be played back later by Replay.  Changes of the board are read from the
+// controller's ChangeJournal, past a cursor of the recorder's own; the view
+// and the messages, which are not in the journal, are passed directly.  Not
+// thread-safe; the controller calls it with its lock held.
+class Recorder {
+ public:
+  // A keyframe is written after every @keyframe_interval records.
+  static constexpr int kDefaultKeyframeInterval = 1 << 16;
+
+  // Returns nullptr when the file can't be created.
+  static std::unique_ptr<Recorder> Create(
+      const std::string& path, int keyframe_interval = kDefaultKeyframeInterval);
+  ~Recorder();
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  // Changes before @cursor are not recorded.
+  void SetJournalCursor(uint64_t cursor);
+  // Writes the changes appended to @journal since the previous call.  Labels
+  // and styles are looked up in @fields, so it has to be called before they
+  // change again.  A recording that misses changes because the journal
+  // overwrote them fails (see @Close()).
+  void ReadJournal(const ChangeJournal& journal, const FieldStore& fields);
+
+  void CenterOn(int x, int y);
+  void AddMessage(const std::string& message);
+
+  // Whenever it returns true, the owner should call @Keyframe().
+  bool NeedsKeyframe() const;
+  void Keyframe(const FieldStore& fields, const BoardFileInfo& info);
+
+  // Flushes and closes the file.  Returns false if anything failed to be
+  // written or was missed.
+  bool Close();
+
+ private:
+  Recorder(std::FILE* file, int keyframe_interval);
+
+  void SetFieldColor(int x, int y, int color);
+  void SetFieldValue(int x, int y, float value);
+  void SetObject(int x, int y, int object);
+  void SetText(int x, int y, const std::string& text);
+  void SetRegionColors(int x0, int y0, int width, int height,
+                       const uint32_t* values, int stride);
+  void SetRegionObjects(int x0, int y0, int width, int height,
+                        const uint32_t* values, int stride);
+  void SetStyle(int x, int y, int id);
+  void DefineStyle(int id, const FieldStore::Style& style);
+  void SetFog();
+  void Clear();
+
+  void BeginRecord(CommandLog::Opcode opcode);
+  void AppendPosition(int x, int y);
+  void AppendRegion(int width, int height, const uint32_t* values,
+                    int stride);
+  void EndRecord();
+
+  std::FILE* file_;
+  bool ok_;
+  uint64_t cursor_;
+  // Reused by @ReadJournal().
+  std::vector<FieldChange> changes_;
+  const int keyframe_interval_;
+  int records_since_keyframe_;
+
+  // Records are collected here and written in large pieces.
+  std::string buffer_;
+
+  std::chrono::steady_clock::time_point start_;
+  int64_t last_time_;
+  int last_x_, last_y_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_RECORDER_H_
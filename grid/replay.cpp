@@ -0,0 +1,355 @@
+#include "replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "board_file.h"
+#include "object.h"
+
+namespace Grid {
+
+namespace {
+
+// Longest uninterrupted sleep, so that @Replay::Stop() is noticed quickly.
+constexpr std::chrono::milliseconds kMaxSleep(100);
+
+}  // namespace
+
+constexpr size_t Replay::kMaxBatchSize;
+
+Replay::Replay(Controller* controller)
+    : controller_(controller), data_(), keyframes_(), duration_(0),
+      cursor_{0, 0, 0, 0}, needs_keyframe_(true), batch_(), batch_size_(0),
+      stopped_(false) {}
+
+bool Replay::Open(const std::string& path) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  std::vector<char> data;
+  char buffer[1 << 16];
+  size_t read;
+  while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + read);
+  }
+  const bool ok = !std::ferror(file);
+  std::fclose(file);
+  if (!ok or data.size() < sizeof(CommandLog::kMagic) or
+      std::memcmp(data.data(), CommandLog::kMagic,
+                  sizeof(CommandLog::kMagic)) != 0) {
+    return false;
+  }
+  CommandLog::Reader reader(data.data() + sizeof(CommandLog::kMagic),
+                            data.data() + data.size());
+  uint64_t version;
+  if (!reader.ReadVarint(version) or version != CommandLog::kVersion) {
+    return false;
+  }
+
+  // Validates the whole log up front and indexes the keyframes.
+  data_.swap(data);
+  keyframes_.clear();
+  Cursor cursor{static_cast<size_t>(reader.position() - data_.data()), 0, 0,
+                0};
+  const Cursor start = cursor;
+  Record record;
+  while (cursor.offset < data_.size()) {
+    const Cursor before = cursor;
+    if (!ReadRecord(cursor, record)) {
+      data_.clear();
+      keyframes_.clear();
+      return false;
+    }
+    if (record.opcode == CommandLog::Opcode::kKeyframe) {
+      keyframes_.push_back(before);
+    }
+  }
+  if (keyframes_.empty() or keyframes_.front().offset != start.offset) {
+    data_.clear();
+    keyframes_.clear();
+    return false;
+  }
+  duration_ = cursor.time;
+  cursor_ = start;
+  needs_keyframe_ = true;
+  return true;
+}
+
+int64_t Replay::Duration() const {
+  return duration_;
+}
+
+int64_t Replay::Position() const {
+  return cursor_.time;
+}
+
+void Replay::Seek(int64_t time) {
+  if (keyframes_.empty()) {
+    return;
+  }
+  // The first keyframe is the first record, so there always is one.
+  auto keyframe = std::upper_bound(
+      keyframes_.begin() + 1, keyframes_.end(), time,
+      [](int64_t time, const Cursor& cursor) -> bool {
+        return time < cursor.time;
+      });
+  cursor_ = *(keyframe - 1);
+  Record record;
+  ReadRecord(cursor_, record);
+  RestoreKeyframe(record);
+  while (cursor_.offset < data_.size()) {
+    Cursor next = cursor_;
+    ReadRecord(next, record);
+    if (record.time > time) {
+      break;
+    }
+    cursor_ = next;
+    Apply(record);
+  }
+  EndBatch();
+}
+
+bool Replay::Play(double speed) {
+  stopped_.store(false);
+  const auto start = std::chrono::steady_clock::now();
+  const int64_t start_time = cursor_.time;
+  Record record;
+  while (cursor_.offset < data_.size()) {
+    if (stopped_.load()) {
+      EndBatch();
+      return false;
+    }
+    Cursor next = cursor_;
+    ReadRecord(next, record);
+    if (speed > 0.0) {
+      const auto due = start + std::chrono::duration_cast<
+          std::chrono::steady_clock::duration>(
+              std::chrono::duration<double, std::micro>(
+                  (record.time - start_time) / speed));
+      if (std::chrono::steady_clock::now() < due) {
+        // Whatever was collected so far is due now.
+        EndBatch();
+        std::this_thread::sleep_until(
+            std::min(due, std::chrono::steady_clock::now() + kMaxSleep));
+        continue;
+      }
+    }
+    cursor_ = next;
+    Apply(record);
+  }
+  EndBatch();
+  return true;
+}
+
+void Replay::Stop() {
+  stopped_.store(true);
+}
+
+bool Replay::ReadRecord(Cursor& cursor, Record& record) const {
+  CommandLog::Reader reader(data_.data() + cursor.offset,
+                            data_.data() + data_.size());
+  uint8_t opcode;
+  uint64_t delta, x, y;
+  if (!reader.ReadByte(opcode) or !reader.ReadVarint(delta)) {
+    return false;
+  }
+  record.opcode = static_cast<CommandLog::Opcode>(opcode);
+  record.time = cursor.time + static_cast<int64_t>(delta);
+  switch (record.opcode) {
+    case CommandLog::Opcode::kSetFieldColor:
+    case CommandLog::Opcode::kSetFieldValue:
+    case CommandLog::Opcode::kSetObject:
+    case CommandLog::Opcode::kSetText:
+    case CommandLog::Opcode::kSetRegionColors:
+    case CommandLog::Opcode::kSetRegionObjects:
+    case CommandLog::Opcode::kSetStyle:
+    case CommandLog::Opcode::kCenterOn:
+      if (!reader.ReadVarint(x) or !reader.ReadVarint(y)) {
+        return false;
+      }
+      record.x = cursor.last_x + CommandLog::UnZigZag(x);
+      record.y = cursor.last_y + CommandLog::UnZigZag(y);
+      break;
+    default:
+      break;
+  }
+  switch (record.opcode) {
+    case CommandLog::Opcode::kKeyframe:
+      if (!reader.ReadVarint(record.value) or
+          record.value > static_cast<uint64_t>(
+              data_.data() + data_.size() - reader.position())) {
+        return false;
+      }
+      record.board_offset = reader.position() - data_.data();
+      record.board_size = record.value;
+      cursor.offset = record.board_offset + record.board_size;
+      cursor.time = record.time;
+      cursor.last_x = cursor.last_y = 0;
+      return true;
+    case CommandLog::Opcode::kSetFieldColor:
+    case CommandLog::Opcode::kSetFieldValue:
+    case CommandLog::Opcode::kSetObject:
+      if (!reader.ReadVarint(record.value)) {
+        return false;
+      }
+      break;
+    case CommandLog::Opcode::kSetStyle:
+      if (!reader.ReadVarint(record.value) or
+          record.value > FieldStore::kMaxStyle) {
+        return false;
+      }
+      break;
+    case CommandLog::Opcode::kDefineStyle:
+      if (!reader.ReadVarint(record.value) or record.value == 0 or
+          record.value > FieldStore::kMaxStyle or
+          !reader.ReadStyle(record.style)) {
+        return false;
+      }
+      break;
+    case CommandLog::Opcode::kSetText:
+    case CommandLog::Opcode::kAddMessage:
+      if (!reader.ReadString(record.text)) {
+        return false;
+      }
+      break;
+    case CommandLog::Opcode::kSetRegionColors:
+    case CommandLog::Opcode::kSetRegionObjects: {
+      uint64_t width, height;
+      if (!reader.ReadVarint(width) or !reader.ReadVarint(height) or
+          width > static_cast<uint64_t>(data_.size()) or
+          height > static_cast<uint64_t>(data_.size()) or
+          width * height > static_cast<uint64_t>(data_.size())) {
+        // Every value takes at least one byte.
+        return false;
+      }
+      record.width = static_cast<int>(width);
+      record.height = static_cast<int>(height);
+      record.values.resize(width * height);
+      for (uint32_t& value : record.values) {
+        uint64_t read_value;
+        if (!reader.ReadVarint(read_value)) {
+          return false;
+        }
+        value = static_cast<uint32_t>(read_value);
+      }
+      break;
+    }
+    case CommandLog::Opcode::kSetFog:
+    case CommandLog::Opcode::kCenterOn:
+    case CommandLog::Opcode::kClear:
+      break;
+    default:
+      return false;
+  }
+  cursor.offset = reader.position() - data_.data();
+  cursor.time = record.time;
+  if (record.opcode != CommandLog::Opcode::kAddMessage and
+      record.opcode != CommandLog::Opcode::kSetFog and
+      record.opcode != CommandLog::Opcode::kClear and
+      record.opcode != CommandLog::Opcode::kDefineStyle) {
+    cursor.last_x = record.x;
+    cursor.last_y = record.y;
+  }
+  return true;
+}
+
+void Replay::Apply(const Record& record) {
+  const int value = static_cast<int>(record.value);
+  switch (record.opcode) {
+    case CommandLog::Opcode::kKeyframe:
+      if (needs_keyframe_) {
+        RestoreKeyframe(record);
+      }
+      return;
+    case CommandLog::Opcode::kSetFieldColor:
+    case CommandLog::Opcode::kSetFieldValue:
+    case CommandLog::Opcode::kSetObject:
+    case CommandLog::Opcode::kSetText:
+    case CommandLog::Opcode::kSetStyle:
+      if (batch_ == nullptr) {
+        batch_.reset(new Controller::Batch(controller_));
+        batch_size_ = 0;
+      }
+      break;
+    default:
+      EndBatch();
+      break;
+  }
+  switch (record.opcode) {
+    case CommandLog::Opcode::kSetFieldColor:
+      batch_->SetFieldColor(record.x, record.y, (value >> 16) & 255,
+                            (value >> 8) & 255, value & 255);
+      break;
+    case CommandLog::Opcode::kSetFieldValue: {
+      const uint32_t bits = static_cast<uint32_t>(record.value);
+      float field_value;
+      std::memcpy(&field_value, &bits, sizeof(field_value));
+      batch_->SetFieldValue(record.x, record.y, field_value);
+      break;
+    }
+    case CommandLog::Opcode::kSetObject:
+      batch_->SetObject(record.x, record.y,
+                        static_cast<Object>((value >> 24) & 255),
+                        (value >> 16) & 255, (value >> 8) & 255, value & 255);
+      break;
+    case CommandLog::Opcode::kSetText:
+      batch_->SetText(record.x, record.y) << record.text;
+      break;
+    case CommandLog::Opcode::kSetStyle:
+      batch_->SetStyle(record.x, record.y, value);
+      break;
+    case CommandLog::Opcode::kDefineStyle:
+      controller_->DefineStyle(value, record.style);
+      break;
+    case CommandLog::Opcode::kSetRegionColors:
+      controller_->SetRegionColors(record.x, record.y, record.width,
+                                   record.height, record.values.data(),
+                                   record.width);
+      break;
+    case CommandLog::Opcode::kSetRegionObjects:
+      controller_->SetRegionObjects(record.x, record.y, record.width,
+                                    record.height, record.values.data(),
+                                    record.width);
+      break;
+    case CommandLog::Opcode::kSetFog:
+      controller_->SetFog();
+      break;
+    case CommandLog::Opcode::kCenterOn:
+      controller_->CenterOn(record.x, record.y);
+      break;
+    case CommandLog::Opcode::kAddMessage:
+      controller_->AddMessage() << record.text;
+      break;
+    case CommandLog::Opcode::kClear:
+      controller_->Clear();
+      break;
+    default:
+      break;
+  }
+  if (batch_ != nullptr and ++batch_size_ >= kMaxBatchSize) {
+    EndBatch();
+  }
+}
+
+void Replay::RestoreKeyframe(const Record& record) {
+  EndBatch();
+  FieldStore fields;
+  BoardFileInfo info;
+  CommandLog::Reader reader(data_.data() + record.board_offset,
+                            data_.data() + record.board_offset +
+                                record.board_size);
+  if (reader.ReadKeyframe(fields, info)) {
+    controller_->ReplaceBoard(fields, info);
+    needs_keyframe_ = false;
+  }
+}
+
+void Replay::EndBatch() {
+  batch_.reset();
+}
+
+}  // namespace Grid
@@ -0,0 +1,105 @@
+#ifndef GRID_REPLAY_H_
+#define GRID_REPLAY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "command_log.h"
+#include "controller.h"
+
+namespace Grid {
+
+// Plays a log written by Controller::StartRecording() back through the
+// controller, at the recorded speed or as fast as possible.
+//
+//   Grid::Replay replay(controller);
+//   if (replay.Open("game.log")) {
+//     replay.Seek(replay.Duration() / 2);
+//     replay.Play(0.0 /* as fast as possible */);
+//   }
+class Replay {
+ public:
+  explicit Replay(Controller* controller);
+
+  Replay(const Replay&) = delete;
+  Replay& operator=(const Replay&) = delete;
+
+  // Reads the whole log into memory and rewinds to its beginning.  Returns
+  // false when the file can't be read or is not a valid log.
+  bool Open(const std::string& path);
+
+  // Length of the recording and the current position, in microseconds.
+  int64_t Duration() const;
+  int64_t Position() const;
+
+  // Restores the board from the last keyframe before @time and applies the
+  // records up to @time as fast as possible.
+  void Seek(int64_t time);
+
+  // Applies the records from the current position to the end of the log.
+  // With @speed equal to 1.0 the records are spaced as they were recorded,
+  // 2.0 plays twice as fast, and 0.0 doesn't wait at all; field changes are
+  // then applied in batches.  Returns false when stopped with @Stop().
+  bool Play(double speed);
+
+  // Makes @Play() return.  May be called from any thread.
+  void Stop();
+
+ private:
+  static constexpr size_t kMaxBatchSize = 4096;
+
+  struct Cursor {
+    size_t offset;
+    int64_t time;
+    int last_x, last_y;
+  };
+
+  struct Record {
+    CommandLog::Opcode opcode;
+    int64_t time;
+    int x, y;
+    uint64_t value;
+    std::string text;
+    FieldStore::Style style;
+    // Values of a region, row by row.
+    int width, height;
+    std::vector<uint32_t> values;
+    // The board of a keyframe.
+    size_t board_offset;
+    size_t board_size;
+  };
+
+  // Reads the record at @cursor and moves the cursor past it.
+  bool ReadRecord(Cursor& cursor, Record& record) const;
+
+  // Applies a record read at the current position.  Field changes are added
+  // to @batch_, other records end it first.
+  void Apply(const Record& record);
+  void RestoreKeyframe(const Record& record);
+  void EndBatch();
+
+  Controller* controller_;
+
+  std::vector<char> data_;
+  // Cursors pointing at the keyframes, in order.
+  std::vector<Cursor> keyframes_;
+  int64_t duration_;
+
+  // Position of the next record to apply.
+  Cursor cursor_;
+  // Set until a keyframe is applied; keyframes only repeat the board
+  // otherwise.
+  bool needs_keyframe_;
+
+  std::unique_ptr<Controller::Batch> batch_;
+  size_t batch_size_;
+
+  std::atomic<bool> stopped_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_REPLAY_H_
@@ -15,8 +15,12 @@ class SquareBoard : public Board {
       double x_min, double y_min, double x_max, double y_max,
       std::function<void(int, int)> callback) const override;
 
-  void DrawField(int x, int y,
+  void FieldPath(int x, int y,
                  const Cairo::RefPtr<Cairo::Context>& context) const override;
+
+  void DrawFieldLayer(
+      int x, int y, Layer layer,
+      const Cairo::RefPtr<Cairo::Context>& context) const override;
 };
 
 }  // namespace Grid
@@ -3,8 +3,6 @@
 #include <cassert>
 #include <cstring>
 
-#include "options.h"
-
 namespace Grid {
 
 void CopySurface(const Cairo::RefPtr<Cairo::ImageSurface>& src,
@@ -23,9 +21,8 @@ void CopySurface(const Cairo::RefPtr<Cairo::ImageSurface>& src,
   dst->mark_dirty();
 }
 
-void ShiftSurface(const Options& options,
-                  const Cairo::RefPtr<Cairo::ImageSurface>& surface,
-                  int dx, int dy) {
+void ShiftSurface(const Cairo::RefPtr<Cairo::ImageSurface>& surface,
+                  int dx, int dy, int fill) {
   const int width = surface->get_width();
   const int height = surface->get_height();
   const int stride = surface->get_stride();
@@ -34,8 +31,7 @@ void ShiftSurface(const Options& options,
          format == Cairo::Format::FORMAT_ARGB32);
   assert(stride >= width * 4);
   surface->flush();
-  const int null_color = options.NullColor();
-  assert(0 <= null_color and null_color < 256);
+  assert(0 <= fill and fill < 256);
   unsigned char* data = surface->get_data();
   if (width == 0 or height == 0) {
     return;
@@ -47,14 +43,14 @@ void ShiftSurface(const Options& options,
         std::memcpy(data + (y + dy) * stride, data + y * stride, width * 4);
       }
       for (int y = height + dy; y < height; y++) {
-        std::memset(data + y * stride, null_color, width * 4);
+        std::memset(data + y * stride, fill, width * 4);
       }
     } else if (dy > 0) {
       for (int y = height - 1 - dy; y >= 0; y--) {
         std::memcpy(data + (y + dy) * stride, data + y * stride, width * 4);
       }
       for (int y = dy - 1; y >= 0; y--) {
-        std::memset(data + y * stride, null_color, width * 4);
+        std::memset(data + y * stride, fill, width * 4);
       }
     }
     if (dx < 0) {
@@ -62,13 +58,13 @@ void ShiftSurface(const Options& options,
         std::memmove(data + y * stride, data + (y * stride - dx * 4),
                      (width + dx) * 4);
         std::memset(data + (y * stride + (width + dx) * 4),
-                    null_color, -dx * 4);
+                    fill, -dx * 4);
       }
     } else if (dx > 0) {
       for (int y = 0; y < height; y++) {
         std::memmove(data + (y * stride + dx * 4), data + y * stride,
                      (width - dx) * 4);
-        std::memset(data  + y * stride, null_color, dx * 4);
+        std::memset(data  + y * stride, fill, dx * 4);
       }
     }
   }
@@ -6,14 +6,13 @@
 
 namespace Grid {
 
-class Options;
-
 void CopySurface(const Cairo::RefPtr<Cairo::ImageSurface>& src,
                  const Cairo::RefPtr<Cairo::ImageSurface>& dst);
 
-void ShiftSurface(const Options& options,
-                  const Cairo::RefPtr<Cairo::ImageSurface>& surface,
-                  int dx, int dy);
+// Moves the contents of the surface by (@dx, @dy).  Uncovered bytes are set
+// to @fill.
+void ShiftSurface(const Cairo::RefPtr<Cairo::ImageSurface>& surface,
+                  int dx, int dy, int fill);
 
 }  // namespace Grid
 
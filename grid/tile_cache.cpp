@@ -0,0 +1,201 @@
+#include "tile_cache.h"
+
+#include <cmath>
+#include <functional>
+
+namespace Grid {
+
+constexpr int TileCache::kTileSize;
+constexpr int TileCache::kLevelsPerOctave;
+constexpr double TileCache::kCellSize;
+constexpr int64_t TileCache::kMaxMarkedCells;
+
+size_t TileCache::KeyHash::operator()(const Key& key) const {
+  return std::hash<uint64_t>()(
+      (static_cast<uint64_t>(static_cast<uint32_t>(key.x)) << 32 |
+       static_cast<uint32_t>(key.y)) * 31 + static_cast<uint32_t>(key.level));
+}
+
+TileCache::TileCache(int64_t budget)
+    : budget_(budget), bytes_(0), clock_(0) {}
+
+int TileCache::Level(double scale) {
+  return static_cast<int>(std::lround(std::log2(scale) * kLevelsPerOctave));
+}
+
+double TileCache::LevelScale(int level) {
+  return std::exp2(static_cast<double>(level) / kLevelsPerOctave);
+}
+
+bool TileCache::enabled() const {
+  return budget_ > 0;
+}
+
+const TileCache::Tile* TileCache::Find(int level, int tile_x, int tile_y) {
+  auto it = tiles_.find(Key{level, tile_x, tile_y});
+  if (it == tiles_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return &it->second->second;
+}
+
+void TileCache::Insert(int level, int tile_x, int tile_y, const Tile& tile) {
+  if (!enabled()) {
+    return;
+  }
+  const Key key{level, tile_x, tile_y};
+  auto it = tiles_.find(key);
+  if (it != tiles_.end()) {
+    Drop(it->second);
+  }
+  auto level_it = levels_.find(level);
+  if (level_it != levels_.end() and level_it->second.scale != tile.scale) {
+    // Only one scale per level; the tiles of the other one don't line up
+    // with the new tile.
+    for (auto entry = lru_.begin(); entry != lru_.end();) {
+      auto next = std::next(entry);
+      if (entry->first.level == level) {
+        Drop(entry);
+      }
+      entry = next;
+    }
+  }
+  lru_.emplace_front(key, tile);
+  tiles_[key] = lru_.begin();
+  LevelInfo& info = levels_[level];
+  info.tiles++;
+  info.scale = tile.scale;
+  bytes_ += TileBytes(tile);
+  while (bytes_ > budget_ and !lru_.empty()) {
+    Drop(std::prev(lru_.end()));
+  }
+}
+
+bool TileCache::NearestLevel(int level, int& nearest) const {
+  if (levels_.empty()) {
+    return false;
+  }
+  auto it = levels_.lower_bound(level);
+  if (it == levels_.end()) {
+    nearest = std::prev(it)->first;
+  } else if (it == levels_.begin() or
+             it->first - level <= level - std::prev(it)->first) {
+    nearest = it->first;
+  } else {
+    nearest = std::prev(it)->first;
+  }
+  return true;
+}
+
+void TileCache::Clear() {
+  lru_.clear();
+  tiles_.clear();
+  levels_.clear();
+  changes_.clear();
+  bytes_ = 0;
+}
+
+uint64_t TileCache::Version() const {
+  return clock_;
+}
+
+void TileCache::MarkChanged(double x, double y) {
+  if (lru_.empty()) {
+    // Tiles made later show the change.
+    return;
+  }
+  changes_[CellKey(Cell(x), Cell(y))] = ++clock_;
+}
+
+void TileCache::MarkChanged(double x0, double y0, double x1, double y1) {
+  if (lru_.empty()) {
+    return;
+  }
+  const int cell_x0 = Cell(x0);
+  const int cell_y0 = Cell(y0);
+  const int cell_x1 = Cell(x1);
+  const int cell_y1 = Cell(y1);
+  if (CellCount(cell_x0, cell_y0, cell_x1, cell_y1) > kMaxMarkedCells) {
+    Clear();
+    return;
+  }
+  clock_++;
+  for (int cell_y = cell_y0; cell_y <= cell_y1; cell_y++) {
+    for (int cell_x = cell_x0; cell_x <= cell_x1; cell_x++) {
+      changes_[CellKey(cell_x, cell_y)] = clock_;
+    }
+  }
+}
+
+bool TileCache::ChangedSince(double x0, double y0, double x1, double y1,
+                             uint64_t version) const {
+  if (version == clock_ or changes_.empty()) {
+    return false;
+  }
+  const int cell_x0 = Cell(x0);
+  const int cell_y0 = Cell(y0);
+  const int cell_x1 = Cell(x1);
+  const int cell_y1 = Cell(y1);
+  if (CellCount(cell_x0, cell_y0, cell_x1, cell_y1) >
+      static_cast<int64_t>(changes_.size())) {
+    // Fewer changed cells than cells in the rectangle.
+    for (const auto& change : changes_) {
+      const int cell_x = static_cast<int32_t>(change.first >> 32);
+      const int cell_y = static_cast<int32_t>(change.first);
+      if (change.second > version and
+          cell_x0 <= cell_x and cell_x <= cell_x1 and
+          cell_y0 <= cell_y and cell_y <= cell_y1) {
+        return true;
+      }
+    }
+    return false;
+  }
+  for (int cell_y = cell_y0; cell_y <= cell_y1; cell_y++) {
+    for (int cell_x = cell_x0; cell_x <= cell_x1; cell_x++) {
+      auto it = changes_.find(CellKey(cell_x, cell_y));
+      if (it != changes_.end() and it->second > version) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+int TileCache::Cell(double coordinate) {
+  return static_cast<int>(std::floor(coordinate / kCellSize));
+}
+
+uint64_t TileCache::CellKey(int cell_x, int cell_y) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(cell_x)) << 32) |
+      static_cast<uint32_t>(cell_y);
+}
+
+int64_t TileCache::CellCount(int cell_x0, int cell_y0, int cell_x1,
+                             int cell_y1) {
+  return (int64_t(cell_x1) - cell_x0 + 1) * (int64_t(cell_y1) - cell_y0 + 1);
+}
+
+int64_t TileCache::TileBytes(const Tile& tile) {
+  int64_t bytes = 0;
+  for (int layer = 0; layer < kNumberOfLayers; layer++) {
+    bytes += static_cast<int64_t>(tile.layers[layer]->get_stride()) *
+        tile.layers[layer]->get_height();
+  }
+  return bytes;
+}
+
+void TileCache::Drop(std::list<Entry>::iterator it) {
+  bytes_ -= TileBytes(it->second);
+  auto level_it = levels_.find(it->first.level);
+  if (--level_it->second.tiles == 0) {
+    levels_.erase(level_it);
+  }
+  tiles_.erase(it->first);
+  lru_.erase(it);
+  if (lru_.empty()) {
+    changes_.clear();
+  }
+}
+
+}  // namespace Grid
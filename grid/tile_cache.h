@@ -0,0 +1,121 @@
+#ifndef GRID_TILE_CACHE_H_
+#define GRID_TILE_CACHE_H_
+
+#include <cairomm/surface.h>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+#include "layer.h"
+
+namespace Grid {
+
+// Layers of the surface of the painter, cut into square tiles and kept after
+// the painter moves to another scale.  A tile at scale s covers pixels
+// [x * kTileSize, (x + 1) * kTileSize) x [y * kTileSize, (y + 1) * kTileSize)
+// of the board scaled by s, so tiles drawn at the same scale line up
+// wherever the surface was.  Scales are grouped into levels,
+// @kLevelsPerOctave levels per doubling of the scale, and a level keeps
+// tiles of one scale at a time.
+//
+// Changes of fields made after a tile was made are recorded in square cells
+// of the board (in the coordinates of Board::CenterOfField()), and the tile
+// is then no longer valid (see @ChangedSince()).  When the
+// tiles take more than the budget, the least recently used ones are
+// dropped.  Not thread-safe.
+class TileCache {
+ public:
+  static constexpr int kTileSize = 128;
+  static constexpr int kLevelsPerOctave = 64;
+
+  struct Tile {
+    double scale;
+    // @Version() when the tile was made.
+    uint64_t version;
+    Cairo::RefPtr<Cairo::ImageSurface> layers[kNumberOfLayers];
+  };
+
+  // @budget is in bytes; 0 disables the cache.
+  explicit TileCache(int64_t budget);
+
+  TileCache(const TileCache&) = delete;
+  TileCache& operator=(const TileCache&) = delete;
+
+  static int Level(double scale);
+  static double LevelScale(int level);
+
+  bool enabled() const;
+
+  // Returns nullptr when there is no such tile.  The tile becomes the most
+  // recently used one; the pointer stays valid until the next @Insert() or
+  // @Clear().
+  const Tile* Find(int level, int tile_x, int tile_y);
+  // Replaces the tile, if any.
+  void Insert(int level, int tile_x, int tile_y, const Tile& tile);
+  // Finds the level with tiles nearest to @level.  Returns false when there
+  // are no tiles.
+  bool NearestLevel(int level, int& nearest) const;
+  void Clear();
+
+  uint64_t Version() const;
+  // The field centered at point (@x, @y) of the board has changed.
+  void MarkChanged(double x, double y);
+  // Fields centered in the rectangle [x0, x1] x [y0, y1] of the board have
+  // changed.  Drops all tiles when the rectangle is large.
+  void MarkChanged(double x0, double y0, double x1, double y1);
+  // True when a field centered in the rectangle changed after @version.
+  bool ChangedSince(double x0, double y0, double x1, double y1,
+                    uint64_t version) const;
+
+ private:
+  // Cells are that large in the coordinates of the board.
+  static constexpr double kCellSize = 64;
+  // @MarkChanged() drops everything rather than marking more cells.
+  static constexpr int64_t kMaxMarkedCells = 4096;
+
+  struct Key {
+    int level;
+    int x;
+    int y;
+
+    bool operator==(const Key& other) const {
+      return level == other.level and x == other.x and y == other.y;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  using Entry = std::pair<Key, Tile>;
+
+  struct LevelInfo {
+    int tiles = 0;
+    // Of all the tiles of the level.
+    double scale = 0;
+  };
+
+  static int Cell(double coordinate);
+  static uint64_t CellKey(int cell_x, int cell_y);
+  static int64_t CellCount(int cell_x0, int cell_y0, int cell_x1,
+                           int cell_y1);
+  static int64_t TileBytes(const Tile& tile);
+  void Drop(std::list<Entry>::iterator it);
+
+  const int64_t budget_;
+  int64_t bytes_;
+  // The most recently used first.
+  std::list<Entry> lru_;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> tiles_;
+  std::map<int, LevelInfo> levels_;
+
+  // The last @clock_ at which a field of the cell changed.  Changes are
+  // recorded only while there are tiles.
+  std::unordered_map<uint64_t, uint64_t> changes_;
+  uint64_t clock_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_TILE_CACHE_H_
@@ -1,6 +1,7 @@
 #include "viewer.h"
 
 #include <cmath>
+#include <limits>
 
 #include "controller.h"
 #include "makra.h"
@@ -38,7 +39,16 @@ bool Viewer::on_draw(const Cairo::RefPtr<Cairo::Context>& context) {
                         surface_buffer->start_x, surface_buffer->start_y);
     context->paint();
   context->restore();
+  const double tx = surface_buffer->start_x + surface_buffer->tx;
+  const double ty = surface_buffer->start_y + surface_buffer->ty;
+  const double scale = surface_buffer->scale;
   painter_->ReleaseCurrentSurfaceBuffer();
+  // Shapes are drawn over the fields on every frame, so changing them
+  // doesn't redraw any field.
+  context->save();
+    options().controller()->DrawShapes(painter_->board(), tx, ty, scale,
+                                       context);
+  context->restore();
   context->save();
     options().controller()->Draw(width, height, context);
   context->restore();
@@ -229,6 +239,23 @@ std::string KeyToString(int keyval) {
 }  // namespace
 
 bool Viewer::on_key_press_event(GdkEventKey* event) {
+  if ((event->state & GDK_CONTROL_MASK) and options().HistoryLength() > 0) {
+    // Going through the past turns, see Options::HistoryLength().
+    int turns = 0;
+    switch (event->keyval) {
+      case GDK_KEY_Left:      turns = -1;                               break;
+      case GDK_KEY_Right:     turns = 1;                                break;
+      case GDK_KEY_Page_Up:   turns = -10;                              break;
+      case GDK_KEY_Page_Down: turns = 10;                               break;
+      case GDK_KEY_Home:      turns = std::numeric_limits<int>::min();  break;
+      case GDK_KEY_End:       turns = std::numeric_limits<int>::max();  break;
+      default:                                                          break;
+    }
+    if (turns != 0) {
+      options().controller()->StepHistory(turns);
+      return true;
+    }
+  }
   options().controller()->KeyPress(KeyToString(event->keyval));
   return true;
 }
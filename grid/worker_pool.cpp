@@ -0,0 +1,80 @@
+#include "worker_pool.h"
+
+#include <cassert>
+
+namespace Grid {
+
+WorkerPool::WorkerPool(int threads)
+    : threads_(), task_(nullptr), count_(0), next_(0), running_(0), job_(0),
+      stopped_(false) {
+  assert(threads >= 1);
+  for (int i = 1; i < threads; i++) {
+    threads_.emplace_back([this]() -> void {
+                            Work();
+                          });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  /* Lock */ {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  job_started_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+int WorkerPool::threads() const {
+  return static_cast<int>(threads_.size()) + 1;
+}
+
+void WorkerPool::Run(int count, const std::function<void(int)>& task) {
+  if (count <= 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  task_ = &task;
+  count_ = count;
+  next_ = 0;
+  job_++;
+  job_started_.notify_all();
+  RunParts(lock);
+  job_finished_.wait(lock, [this]() -> bool {
+                              return next_ == count_ and running_ == 0;
+                            });
+  task_ = nullptr;
+}
+
+void WorkerPool::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t last_job = 0;
+  while (true) {
+    job_started_.wait(lock, [this, last_job]() -> bool {
+                              return stopped_ or job_ != last_job;
+                            });
+    if (stopped_) {
+      return;
+    }
+    last_job = job_;
+    RunParts(lock);
+  }
+}
+
+void WorkerPool::RunParts(std::unique_lock<std::mutex>& lock) {
+  while (task_ != nullptr and next_ < count_) {
+    const int part = next_++;
+    running_++;
+    const std::function<void(int)>& task = *task_;
+    lock.unlock();
+    task(part);
+    lock.lock();
+    running_--;
+  }
+  if (next_ == count_ and running_ == 0) {
+    job_finished_.notify_all();
+  }
+}
+
+}  // namespace Grid
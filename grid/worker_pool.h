@@ -0,0 +1,54 @@
+#ifndef GRID_WORKER_POOL_H_
+#define GRID_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Grid {
+
+// A fixed set of threads that run the parts of a job in parallel.  Only one
+// thread at a time may call @Run().
+class WorkerPool {
+ public:
+  // Starts @threads - 1 threads; the thread calling @Run() works too.
+  explicit WorkerPool(int threads);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int threads() const;
+
+  // Calls @task(i) for every i in [0, @count), in parallel and in no
+  // particular order, and returns when all the calls returned.
+  void Run(int count, const std::function<void(int)>& task);
+
+ private:
+  void Work();
+  // Runs parts of the current job until there are none left.  Requires
+  // @lock to be locked; unlocks it while a part runs.
+  void RunParts(std::unique_lock<std::mutex>& lock);
+
+  std::vector<std::thread> threads_;
+
+  // Guards the members below.
+  std::mutex mutex_;
+  std::condition_variable job_started_;
+  std::condition_variable job_finished_;
+  const std::function<void(int)>* task_;
+  int count_;
+  // Next part to run, and the number of parts running.
+  int next_;
+  int running_;
+  // Incremented with every job.
+  uint64_t job_;
+  bool stopped_;
+};
+
+}  // namespace Grid
+
+#endif  // GRID_WORKER_POOL_H_
@@ -31,48 +31,30 @@ TypPola pole(int x, int y) {
   return it->second;
 }
 
-void UstawPole(int x, int y, TypPola typ) {
+int Styl(TypPola typ) {
+  return static_cast<int>(typ) + 1;
+}
+
+void DefiniujStyle() {
+  controller->DefineStyle(Styl(TypPola::kUnknown), 128, 128, 128,
+                          Grid::Object::kNone, 0, 0, 0,
+                          "Unknown ({x}, {y})");
+  controller->DefineStyle(Styl(TypPola::kMe), 255, 255, 255,
+                          Grid::Object::kSad, 0, 255, 0, "({x}, {y})");
+  controller->DefineStyle(Styl(TypPola::kStart), 255, 216, 0,
+                          Grid::Object::kSquare, 0, 0, 255,
+                          "Start ({x}, {y})");
+  controller->DefineStyle(Styl(TypPola::kEnd), 255, 0, 0,
+                          Grid::Object::kFlag, 0, 255, 0, "End ({x}, {y})");
+  controller->DefineStyle(Styl(TypPola::kWall), 0, 0, 0,
+                          Grid::Object::kNone, 0, 0, 0, "Wall");
+  controller->DefineStyle(Styl(TypPola::kEmpty), 255, 255, 255,
+                          Grid::Object::kNone, 0, 0, 0, "Empty ({x}, {y})");
+}
+
+void UstawPole(Grid::Controller::Batch& batch, int x, int y, TypPola typ) {
   zajete[make_pair(x, y)] = typ;
-  switch (typ) {
-    case TypPola::kUnknown:
-      controller->SetFieldColor(x, y, 128, 128, 128);
-      controller->SetObject(x, y, Grid::Object::kNone, 0, 0, 0);
-      controller->SetText(x, y) << "Unknown (" << x << ", " << y << ")";
-      break;
-
-    case TypPola::kMe:
-      controller->SetFieldColor(x, y, 255, 255, 255);
-      controller->SetObject(x, y, Grid::Object::kSad, 0, 255, 0);
-      controller->SetText(x, y) << "(" << x << ", " << y << ")";
-      break;
-
-    case TypPola::kStart:
-      controller->SetFieldColor(x, y, 255, 216, 0);
-      controller->SetObject(x, y, Grid::Object::kSquare, 0, 0, 255);
-      controller->SetText(x, y) << "Start (" << x << ", " << y << ")";
-      break;
-
-    case TypPola::kEnd:
-      controller->SetFieldColor(x, y, 255, 0, 0);
-      controller->SetObject(x, y, Grid::Object::kFlag, 0, 255, 0);
-      controller->SetText(x, y) << "End (" << x << ", " << y << ")";
-      break;
-
-    case TypPola::kWall:
-      controller->SetFieldColor(x, y, 0, 0, 0);
-      controller->SetObject(x, y, Grid::Object::kNone, 0, 0, 0);
-      controller->SetText(x, y) << "Wall";
-      break;
-
-    case TypPola::kEmpty:
-      controller->SetFieldColor(x, y, 255, 255, 255);
-      controller->SetObject(x, y, Grid::Object::kNone, 0, 0, 0);
-      controller->SetText(x, y) << "Empty (" << x << ", " << y << ")";
-      break;
-
-    deafult:
-      debug() << "Something's wrong :(";
-  }
+  batch.SetStyle(x, y, Styl(typ));
 }
 
 int my_x, my_y;
@@ -125,6 +107,7 @@ void Scan() {
   int n;
   controller->SetFog();
   in("%d", &n);
+  vector<tuple<int, int, TypPola>> pola;
   while (n--) {
     char buffer[10];
     in("%s", buffer);
@@ -148,9 +131,13 @@ void Scan() {
       debug() << imie(buffer);
       assert(false);
     }
-    UstawPole(x, y, t);
+    pola.emplace_back(x, y, t);
+  }
+  Grid::Controller::Batch batch(controller);
+  for (const auto& pole : pola) {
+    UstawPole(batch, get<0>(pole), get<1>(pole), get<2>(pole));
   }
-  UstawPole(my_x, my_y, TypPola::kMe);
+  UstawPole(batch, my_x, my_y, TypPola::kMe);
 }
 
 int TurnsLeft() {
@@ -188,6 +175,7 @@ int main(int argc, char** argv) {
   auto board = std::make_unique<Grid::SquareBoard>();
   //auto board = std::make_unique<Grid::HexBoard>();
   controller->OnKeyPress(OnKeyPress);
+  DefiniujStyle();
   Grid::RunBoard(argc, argv, options, std::move(board), Algorytm);
   return 0;
 }
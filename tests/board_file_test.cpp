@@ -0,0 +1,158 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "board_file.h"
+#include "check.h"
+#include "field_store.h"
+
+using namespace Grid;
+
+namespace {
+
+const char kPath[] = "/tmp/grid_board_file_test.board";
+const char kBrokenPath[] = "/tmp/grid_board_file_test_broken.board";
+// Background of field (0, 0), to find its chunk in the file.
+constexpr int kMarker = 0x5eed5eed;
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+void WriteFile(const std::string& path, const std::string& contents) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(contents.data(), contents.size());
+}
+
+// Saves a small board to @kPath and returns the contents of the file.
+std::string SaveBoard() {
+  FieldStore fields;
+  bool created;
+  fields.FindOrCreate(0, 0, kMarker, 0, 1, created).label() =
+      fields.InternLabel("marked");
+  fields.FindOrCreate(100, -100, 2, 3, 1, created).set_value(1.5f);
+  fields.DefineStyle(1, FieldStore::Style{4, 5, "{x}"});
+  fields.FindOrCreate(-1, 5, 0, 0, 1, created).style() = 1;
+  CHECK(SaveBoardFile(kPath, fields, BoardFileInfo{1, -1, 100, -100, 5}));
+  return ReadFile(kPath);
+}
+
+// Offset of the chunk of field (0, 0) in @file.
+size_t MarkedChunk(const std::string& file) {
+  const size_t marker = file.find(
+      std::string(reinterpret_cast<const char*>(&kMarker), sizeof(kMarker)));
+  CHECK(marker != std::string::npos);
+  return marker - offsetof(FieldStore::Chunk, background) -
+         FieldStore::IndexInChunk(0, 0) * sizeof(int);
+}
+
+void TestRoundTrip() {
+  SaveBoard();
+  FieldStore loaded;
+  BoardFileInfo info;
+  CHECK(LoadBoardFile(kPath, loaded, info));
+  CHECK(info.current_time == 1 and info.min_x == -1 and info.max_x == 100 and
+        info.min_y == -100 and info.max_y == 5);
+  CHECK(loaded.Size() == 3);
+  CHECK(loaded.Label(loaded.Find(0, 0).label()) == "marked");
+  CHECK(loaded.Find(100, -100).value() == 1.5f);
+  CHECK(loaded.Find(-1, 5).style() == 1);
+  CHECK(loaded.FindStyle(1) != nullptr and loaded.FindStyle(1)->label == "{x}");
+}
+
+bool LoadsTruncated(const std::string& file, size_t length) {
+  WriteFile(kBrokenPath, file.substr(0, length));
+  FieldStore fields;
+  BoardFileInfo info;
+  bool created;
+  fields.FindOrCreate(7, 7, 1, 1, 0, created);
+  const bool loaded = LoadBoardFile(kBrokenPath, fields, info);
+  // A board that fails to load is left intact.
+  CHECK(loaded or (fields.Size() == 1 and fields.Find(7, 7)));
+  return loaded;
+}
+
+void TestTruncated() {
+  const std::string file = SaveBoard();
+  // Cuts in the header and the index, in the chunks, which would end out of
+  // the file, and in the label and style tables at the end.
+  for (size_t length = 0; length < 512; length++) {
+    CHECK(!LoadsTruncated(file, length));
+  }
+  for (size_t length = 512; length < file.size(); length += 16381) {
+    CHECK(!LoadsTruncated(file, length));
+  }
+  for (size_t length = file.size() - 64; length < file.size(); length++) {
+    CHECK(!LoadsTruncated(file, length));
+  }
+  CHECK(LoadsTruncated(file, file.size()));
+}
+
+void TestCorruptHeader() {
+  const std::string file = SaveBoard();
+  FieldStore fields;
+  BoardFileInfo info;
+  std::string broken = file;
+  broken[0] ^= 1;
+  WriteFile(kBrokenPath, broken);
+  CHECK(!LoadBoardFile(kBrokenPath, fields, info));
+  // The version follows the magic.
+  broken = file;
+  broken[8] ^= 1;
+  WriteFile(kBrokenPath, broken);
+  CHECK(!LoadBoardFile(kBrokenPath, fields, info));
+  CHECK(!LoadBoardFile("/tmp/grid_board_file_test_missing.board", fields,
+                       info));
+}
+
+// Chunks are checked when they are first used; a broken one is seen as
+// empty and doesn't take the rest of the board with it.
+void TestCorruptChunk() {
+  const std::string file = SaveBoard();
+  const size_t chunk = MarkedChunk(file);
+
+  std::string broken = file;
+  const uint32_t bad_label = 1000;
+  std::memcpy(&broken[chunk + offsetof(FieldStore::Chunk, label) +
+                      FieldStore::IndexInChunk(0, 0) * sizeof(uint32_t)],
+              &bad_label, sizeof(bad_label));
+  WriteFile(kBrokenPath, broken);
+  FieldStore fields;
+  BoardFileInfo info;
+  CHECK(LoadBoardFile(kBrokenPath, fields, info));
+  CHECK(!fields.Find(0, 0));
+  CHECK(fields.Find(100, -100).value() == 1.5f);
+
+  // A chunk with more fields than its index entry says.
+  broken = file;
+  broken[chunk + offsetof(FieldStore::Chunk, occupancy) + 8] ^= 1;
+  WriteFile(kBrokenPath, broken);
+  FieldStore other;
+  CHECK(LoadBoardFile(kBrokenPath, other, info));
+  CHECK(!other.Find(0, 0));
+  // The fields of the broken chunk are dropped; writing to it starts it
+  // over.
+  CHECK(other.Size() == 2);
+  bool created;
+  other.FindOrCreate(1, 1, 0, 0, 0, created);
+  CHECK(created and other.Size() == 3);
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+  TestTruncated();
+  TestCorruptHeader();
+  TestCorruptChunk();
+  std::remove(kPath);
+  std::remove(kBrokenPath);
+  return 0;
+}
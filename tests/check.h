@@ -0,0 +1,17 @@
+#ifndef TESTS_CHECK_H_
+#define TESTS_CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+// Like assert(), but also checked in release builds.
+#define CHECK(condition)                                               \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__,      \
+                   __LINE__, #condition);                              \
+      std::exit(1);                                                    \
+    }                                                                  \
+  } while (false)
+
+#endif  // TESTS_CHECK_H_
@@ -0,0 +1,219 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "change_journal.h"
+#include "check.h"
+#include "command_log.h"
+#include "field_store.h"
+#include "recorder.h"
+
+using namespace Grid;
+
+namespace {
+
+void TestVarints() {
+  const std::vector<uint64_t> values = {
+      0, 1, 127, 128, 300, uint64_t(1) << 35,
+      std::numeric_limits<uint64_t>::max()};
+  std::string out;
+  for (uint64_t value : values) {
+    CommandLog::AppendVarint(out, value);
+  }
+  CommandLog::AppendString(out, std::string("a\0b", 3));
+  CommandLog::Reader reader(out.data(), out.data() + out.size());
+  for (uint64_t value : values) {
+    uint64_t read;
+    CHECK(reader.ReadVarint(read) and read == value);
+  }
+  std::string text;
+  CHECK(reader.ReadString(text) and text == std::string("a\0b", 3));
+  uint8_t byte;
+  CHECK(!reader.ReadByte(byte));
+
+  for (int64_t value : {int64_t(0), int64_t(-1), int64_t(1),
+                        std::numeric_limits<int64_t>::min(),
+                        std::numeric_limits<int64_t>::max()}) {
+    CHECK(CommandLog::UnZigZag(CommandLog::ZigZag(value)) == value);
+  }
+  CHECK(CommandLog::ZigZag(-1) == 1 and CommandLog::ZigZag(1) == 2);
+}
+
+void TestTruncatedValues() {
+  std::string out;
+  CommandLog::AppendVarint(out, uint64_t(1) << 40);
+  CommandLog::AppendString(out, "label");
+  for (size_t length = 0; length < out.size(); length++) {
+    CommandLog::Reader reader(out.data(), out.data() + length);
+    uint64_t value;
+    std::string text;
+    CHECK(!(reader.ReadVarint(value) and reader.ReadString(text)));
+  }
+}
+
+FieldStore MakeBoard() {
+  FieldStore fields;
+  bool created;
+  fields.FindOrCreate(0, 0, 1, 2, 5, created).label() =
+      fields.InternLabel("first");
+  fields.FindOrCreate(-70, 3, 3, 4, 6, created).set_value(0.25f);
+  fields.FindOrCreate(200, -200, 5, 6, 7, created);
+  fields.DefineStyle(3, FieldStore::Style{7, 8, "({x}, {y})"});
+  FieldStore::FieldRef styled = fields.FindOrCreate(9, 9, 0, 0, 7, created);
+  styled.style() = 3;
+  FieldStore::FieldRef detached = fields.FindOrCreate(10, 9, 0, 0, 7, created);
+  detached.style() = 3;
+  fields.DetachStyle(detached, 10, 9);
+  return fields;
+}
+
+void TestKeyframe() {
+  const FieldStore fields = MakeBoard();
+  const BoardFileInfo info{7, -70, 200, -200, 9};
+  std::string out;
+  CommandLog::AppendKeyframe(out, fields, info);
+
+  FieldStore loaded;
+  BoardFileInfo loaded_info;
+  CommandLog::Reader reader(out.data(), out.data() + out.size());
+  CHECK(reader.ReadKeyframe(loaded, loaded_info));
+  CHECK(loaded_info.current_time == 7 and loaded_info.min_x == -70 and
+        loaded_info.max_x == 200 and loaded_info.min_y == -200 and
+        loaded_info.max_y == 9);
+  CHECK(loaded.Size() == fields.Size());
+  int differences = 0;
+  loaded.ForEachDifference(fields,
+                           [&differences](int, int) -> void { differences++; });
+  CHECK(differences == 0);
+  CHECK(loaded.Find(-70, 3).value() == 0.25f);
+  CHECK(loaded.Find(0, 0).last_update_time() == 5);
+  std::string expanded;
+  CHECK(loaded.FieldLabel(loaded.Find(10, 9).label(), 10, 9, expanded) ==
+        "(10, 9)");
+  CHECK(loaded.FindStyle(3) != nullptr and
+        loaded.FindStyle(3)->label == "({x}, {y})");
+
+  // Every truncated keyframe is rejected.
+  for (size_t length = 0; length < out.size(); length++) {
+    FieldStore truncated;
+    BoardFileInfo truncated_info;
+    CommandLog::Reader truncated_reader(out.data(), out.data() + length);
+    CHECK(!truncated_reader.ReadKeyframe(truncated, truncated_info));
+  }
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Changes appended to the journal come out of the recorder as records.
+void TestRecorder() {
+  const std::string path = "/tmp/grid_command_log_test.log";
+  ChangeJournal journal(4 /* capacity_log2 */);
+  FieldStore fields;
+  std::unique_ptr<Recorder> recorder = Recorder::Create(path);
+  CHECK(recorder != nullptr);
+  recorder->Keyframe(fields, BoardFileInfo{0, 0, 0, 0, 0});
+  recorder->SetJournalCursor(journal.End());
+  const uint32_t label = fields.InternLabel("text");
+  fields.DefineStyle(2, FieldStore::Style{1, 2, "style"});
+  journal.Append({FieldChange::Kind::kColor, 3, -4, 99});
+  journal.Append({FieldChange::Kind::kText, 3, -4, label});
+  journal.Append({FieldChange::Kind::kStyleDefinition, 0, 0, 2});
+  journal.Append({FieldChange::Kind::kObjectRegion, 10, 20,
+                  (int64_t(2) << 32) | 1,
+                  std::make_shared<const std::vector<uint32_t>>(
+                      std::vector<uint32_t>{5, 6})});
+  recorder->ReadJournal(journal, fields);
+  journal.Append({FieldChange::Kind::kFog, 0, 0, 1});
+  recorder->ReadJournal(journal, fields);
+  recorder->CenterOn(1, 1);
+  CHECK(recorder->Close());
+
+  const std::string log = ReadFile(path);
+  std::remove(path.c_str());
+  CommandLog::Reader reader(log.data(), log.data() + log.size());
+  uint8_t byte;
+  for (size_t i = 0; i < sizeof(CommandLog::kMagic); i++) {
+    CHECK(reader.ReadByte(byte) and byte == uint8_t(CommandLog::kMagic[i]));
+  }
+  uint64_t value;
+  CHECK(reader.ReadVarint(value) and value == CommandLog::kVersion);
+  const auto expect = [&reader](CommandLog::Opcode opcode) -> void {
+    uint8_t byte;
+    uint64_t time;
+    CHECK(reader.ReadByte(byte) and byte == static_cast<uint8_t>(opcode));
+    CHECK(reader.ReadVarint(time));
+  };
+  const auto expect_varint = [&reader](uint64_t expected) -> void {
+    uint64_t value;
+    CHECK(reader.ReadVarint(value) and value == expected);
+  };
+  expect(CommandLog::Opcode::kKeyframe);
+  CHECK(reader.ReadVarint(value));
+  FieldStore board;
+  BoardFileInfo info;
+  CHECK(reader.ReadKeyframe(board, info) and board.Size() == 0);
+
+  expect(CommandLog::Opcode::kSetFieldColor);
+  expect_varint(CommandLog::ZigZag(3));
+  expect_varint(CommandLog::ZigZag(-4));
+  expect_varint(99);
+  expect(CommandLog::Opcode::kSetText);
+  expect_varint(0);
+  expect_varint(0);
+  std::string text;
+  CHECK(reader.ReadString(text) and text == "text");
+  expect(CommandLog::Opcode::kDefineStyle);
+  expect_varint(2);
+  FieldStore::Style style;
+  CHECK(reader.ReadStyle(style) and style.background == 1 and
+        style.object == 2 and style.label == "style");
+  expect(CommandLog::Opcode::kSetRegionObjects);
+  expect_varint(CommandLog::ZigZag(7));
+  expect_varint(CommandLog::ZigZag(24));
+  for (uint64_t expected : {2, 1, 5, 6}) {
+    expect_varint(expected);
+  }
+  expect(CommandLog::Opcode::kSetFog);
+  expect(CommandLog::Opcode::kCenterOn);
+  expect_varint(CommandLog::ZigZag(-9));
+  expect_varint(CommandLog::ZigZag(-19));
+  CHECK(!reader.ReadByte(byte));
+}
+
+// A recorder that falls behind the journal fails instead of writing a log
+// with holes.
+void TestRecorderOverrun() {
+  const std::string path = "/tmp/grid_command_log_test_overrun.log";
+  ChangeJournal journal(2 /* capacity_log2 */);
+  FieldStore fields;
+  std::unique_ptr<Recorder> recorder = Recorder::Create(path);
+  CHECK(recorder != nullptr);
+  recorder->SetJournalCursor(journal.End());
+  for (int i = 0; i < 5; i++) {
+    journal.Append({FieldChange::Kind::kFog, 0, 0, i});
+  }
+  recorder->ReadJournal(journal, fields);
+  CHECK(!recorder->Close());
+  std::remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+  TestVarints();
+  TestTruncatedValues();
+  TestKeyframe();
+  TestRecorder();
+  TestRecorderOverrun();
+  return 0;
+}
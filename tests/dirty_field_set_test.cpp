@@ -0,0 +1,77 @@
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <utility>
+
+#include "check.h"
+#include "dirty_field_set.h"
+
+using namespace Grid;
+
+namespace {
+
+void TestAddAndDrain() {
+  DirtyFieldSet set;
+  CHECK(set.Add(1, 2));
+  // The chunk is already pending.
+  CHECK(!set.Add(3, 4));
+  CHECK(!set.Add(1, 2));
+  CHECK(set.Add(-1, 2));
+  std::set<std::pair<int, int>> drained;
+  set.Drain([&drained](int x, int y) -> void { drained.emplace(x, y); });
+  CHECK((drained == std::set<std::pair<int, int>>{{1, 2}, {3, 4}, {-1, 2}}));
+  drained.clear();
+  set.Drain([&drained](int x, int y) -> void { drained.emplace(x, y); });
+  CHECK(drained.empty());
+  CHECK(set.Add(3, 4));
+}
+
+// A writer adds fields, several times each, while the reader drains them.
+// Everything added has to come out, and nothing else.
+void TestConcurrentDrain() {
+  constexpr int kRounds = 50;
+  constexpr int kWidth = 200;
+  constexpr int kHeight = 100;
+  DirtyFieldSet set;
+  std::atomic<bool> done(false);
+  std::set<std::pair<int, int>> drained;
+  bool stray = false;
+  std::thread reader([&set, &done, &drained, &stray]() -> void {
+    const auto collect = [&drained, &stray](int x, int y) -> void {
+      stray = stray or x < -kWidth or x >= kWidth or (x & 1) != 0 or
+          y < -kHeight or y >= kHeight;
+      drained.emplace(x, y);
+    };
+    for (;;) {
+      // The writer may add more during the drain, so the flag is read first.
+      const bool last = done.load(std::memory_order_acquire);
+      set.Drain(collect);
+      if (last) {
+        return;
+      }
+    }
+  });
+  for (int round = 0; round < kRounds; round++) {
+    for (int y = -kHeight; y < kHeight; y++) {
+      for (int x = -kWidth; x < kWidth; x += 2) {
+        set.Add(x, y);
+      }
+    }
+  }
+  done.store(true, std::memory_order_release);
+  reader.join();
+  CHECK(!stray);
+  CHECK(drained.size() == static_cast<size_t>(kWidth * 2 * kHeight));
+  int64_t left = 0;
+  set.Drain([&left](int, int) -> void { left++; });
+  CHECK(left == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestAddAndDrain();
+  TestConcurrentDrain();
+  return 0;
+}
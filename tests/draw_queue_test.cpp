@@ -0,0 +1,112 @@
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "check.h"
+#include "draw_queue.h"
+
+using namespace Grid;
+
+namespace {
+
+struct Popped {
+  int x, y;
+  LayerMask layers;
+};
+
+std::vector<Popped> PopAll(DrawQueue& queue) {
+  std::vector<Popped> popped;
+  Popped field;
+  while (queue.Pop(field.x, field.y, field.layers)) {
+    popped.push_back(field);
+  }
+  CHECK(queue.empty() and queue.size() == 0);
+  return popped;
+}
+
+void TestBucketOrder() {
+  DrawQueue queue;
+  queue.Add(0, 0, 1, 5);
+  queue.Add(1, 0, 1, 2);
+  queue.Add(2, 0, 1, DrawQueue::kBuckets - 1);
+  queue.Add(-3, 7, 1, 0);
+  CHECK(queue.size() == 4);
+  CHECK(!queue.EmptyBelow(1));
+  const std::vector<Popped> popped = PopAll(queue);
+  CHECK(popped.size() == 4);
+  CHECK(popped[0].x == -3 and popped[0].y == 7);
+  CHECK(popped[1].x == 1);
+  CHECK(popped[2].x == 0);
+  CHECK(popped[3].x == 2);
+}
+
+void TestMergeAndErase() {
+  DrawQueue queue;
+  queue.Add(4, 4, LayerBit(Layer::kTerrain), 6);
+  // Layers are merged and the lower bucket is kept.
+  queue.Add(4, 4, LayerBit(Layer::kLabels), 3);
+  queue.Add(4, 4, LayerBit(Layer::kOverlay), 9);
+  queue.Add(5, 4, 1, 4);
+  queue.Erase(5, 4);
+  queue.Erase(100, 100);
+  CHECK(queue.size() == 1);
+  CHECK(queue.EmptyBelow(3) and !queue.EmptyBelow(4));
+  const std::vector<Popped> popped = PopAll(queue);
+  CHECK(popped.size() == 1);
+  CHECK(popped[0].x == 4 and popped[0].y == 4);
+  CHECK(popped[0].layers == (LayerBit(Layer::kTerrain) |
+                             LayerBit(Layer::kLabels) |
+                             LayerBit(Layer::kOverlay)));
+}
+
+void TestRebucket() {
+  DrawQueue queue;
+  for (int x = 0; x < 100; x++) {
+    queue.Add(x, x % 3, 1, x % DrawQueue::kBuckets);
+  }
+  // Stale entries, left behind by moving fields to lower buckets, mustn't be
+  // popped.
+  for (int x = 0; x < 100; x += 10) {
+    queue.Add(x, x % 3, 2, 0);
+  }
+  // Reverses the order: the farther right, the sooner.
+  queue.Rebucket([](int x, int, int) -> int {
+    return (99 - x) * DrawQueue::kBuckets / 100;
+  });
+  CHECK(queue.size() == 100);
+  const std::vector<Popped> popped = PopAll(queue);
+  CHECK(popped.size() == 100);
+  std::set<int> seen;
+  int last_bucket = 0;
+  for (const Popped& field : popped) {
+    CHECK(seen.insert(field.x).second);
+    CHECK(field.y == field.x % 3);
+    CHECK(field.layers == (field.x % 10 == 0 ? 3u : 1u));
+    const int bucket = (99 - field.x) * DrawQueue::kBuckets / 100;
+    CHECK(bucket >= last_bucket);
+    last_bucket = bucket;
+  }
+}
+
+void TestClear() {
+  DrawQueue queue;
+  queue.Add(1, 1, 1, 1);
+  queue.Add(2, 2, 1, 2);
+  queue.Clear();
+  CHECK(queue.empty() and queue.EmptyBelow(DrawQueue::kBuckets));
+  int x, y;
+  LayerMask layers;
+  CHECK(!queue.Pop(x, y, layers));
+  queue.Add(1, 1, 4, 0);
+  CHECK(queue.Pop(x, y, layers) and x == 1 and y == 1 and layers == 4);
+}
+
+}  // namespace
+
+int main() {
+  TestBucketOrder();
+  TestMergeAndErase();
+  TestRebucket();
+  TestClear();
+  return 0;
+}